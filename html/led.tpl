@@ -0,0 +1,18 @@
+<!doctype html>
+<html lang="en">
+<head>
+    <meta charset="utf-8">
+    <title>ECUSpy32 LED</title>
+    <link rel="stylesheet" href="css/pure-min.css">
+    <link rel="stylesheet" href="css/ecuspy.css">
+</head>
+<body>
+	<div id="main">
+		<p>The LED is %ledstate%. Page served %counter% times.</p>
+		<form class="pure-form" method="post" action="led.cgi">
+			<button class="pure-button" name="led" value="1">On</button>
+			<button class="pure-button" name="led" value="0">Off</button>
+		</form>
+	</div>
+</body>
+</html>
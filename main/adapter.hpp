@@ -0,0 +1,46 @@
+/*
+ * adapter.hpp
+ *
+ *  OBD-II adapter interface. One request goes out on the bus, every ECU
+ *  that answers gives one response. Response data starts after the
+ *  response mode byte (mode + 0x40):
+ *
+ *      mode 01         pid, A, B, ...
+ *      mode 02         pid, frame, A, B, ...
+ *      mode 03/07/0A   count, {DTC hi, DTC lo}*count
+ */
+
+#ifndef MAIN_ADAPTER_HPP_
+#define MAIN_ADAPTER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace ecuspy {
+
+constexpr size_t OBD_MAX_DATA = 64;
+constexpr size_t OBD_MAX_ECUS = 4;
+
+struct ObdResponse {
+	uint16_t ecu;
+	uint8_t len;
+	uint8_t data[OBD_MAX_DATA];
+};
+
+class ObdAdapter {
+public:
+	virtual ~ObdAdapter() {}
+
+	/**
+	 * Send mode plus args and collect the responses, at most max.
+	 * Returns the number of responses, 0 when no ECU answered, -1 on an
+	 * adapter or bus error. Blocks for the whole round trip.
+	 */
+	virtual int request(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max) = 0;
+
+	virtual const char* name() const = 0;
+};
+
+}
+
+#endif /* MAIN_ADAPTER_HPP_ */
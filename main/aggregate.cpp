@@ -0,0 +1,175 @@
+/*
+ * aggregate.cpp
+ *
+ *  Sliding-window statistics, see aggregate.hpp.
+ */
+
+#include <string.h>
+
+#include "aggregate.hpp"
+#include "obd.hpp"
+
+namespace ecuspy {
+
+void PidWindows::reset(uint8_t pid, float lo, float hi) {
+	m_pid = pid;
+	m_lo = lo;
+	m_hi = hi > lo ? hi : lo + 1;
+	for (size_t i = 0; i < AGG_WINDOWS; i++) {
+		Window& w = m_windows[i];
+		w.width = AGG_WINDOW_MS[i] / AGG_SLOTS;
+		w.first = w.next = 0;
+		w.count = 0;
+		w.sum = 0;
+		memset(w.hist, 0, sizeof(w.hist));
+		w.mins.clear();
+		w.maxs.clear();
+	}
+}
+
+size_t PidWindows::bin(float value) const {
+	if (value <= m_lo)
+		return 0;
+	size_t b = (value - m_lo) * AGG_BINS / (m_hi - m_lo);
+	return b < AGG_BINS ? b : AGG_BINS - 1;
+}
+
+void PidWindows::open(Window& w, uint32_t index) {
+	Bucket& b = w.at(w.next++);
+	b.index = index;
+	b.count = 0;
+	b.sum = 0;
+	memset(b.hist, 0, sizeof(b.hist));
+}
+
+//The bucket being filled is complete, its min and max join the deques
+void PidWindows::close(Window& w) {
+	uint8_t slot = (w.next - 1) % AGG_SLOTS;
+	const Bucket& b = w.buckets[slot];
+	while (!w.mins.empty() && w.buckets[w.mins.back()].min >= b.min)
+		w.mins.popBack();
+	w.mins.pushBack(slot);
+	while (!w.maxs.empty() && w.buckets[w.maxs.back()].max <= b.max)
+		w.maxs.popBack();
+	w.maxs.pushBack(slot);
+}
+
+void PidWindows::drop(Window& w) {
+	uint8_t slot = w.first % AGG_SLOTS;
+	const Bucket& b = w.buckets[slot];
+	w.count -= b.count;
+	w.sum -= b.sum;
+	for (size_t i = 0; i < AGG_BINS; i++)
+		w.hist[i] -= b.hist[i];
+	if (!w.mins.empty() && w.mins.front() == slot)
+		w.mins.popFront();
+	if (!w.maxs.empty() && w.maxs.front() == slot)
+		w.maxs.popFront();
+	w.first++;
+}
+
+//Buckets that started a window's duration or more before now's bucket are out
+void PidWindows::expire(Window& w, uint32_t now) {
+	uint32_t index = now / w.width;
+	while (w.first != w.next && (int32_t)(index - w.at(w.first).index) >= (int32_t)AGG_SLOTS)
+		drop(w);
+}
+
+void PidWindows::add(uint32_t ts, float value) {
+	size_t b = bin(value);
+	for (auto& w : m_windows) {
+		uint32_t index = ts / w.width;
+		//A late sample goes into the current bucket
+		if (w.first == w.next || (int32_t)(index - w.at(w.next - 1).index) > 0) {
+			if (w.first != w.next)
+				close(w);
+			expire(w, ts);
+			open(w, index);
+		}
+		Bucket& cur = w.at(w.next - 1);
+		if (!cur.count || value < cur.min)
+			cur.min = value;
+		if (!cur.count || value > cur.max)
+			cur.max = value;
+		cur.count++;
+		cur.sum += value;
+		cur.hist[b]++;
+		w.count++;
+		w.sum += value;
+		w.hist[b]++;
+	}
+}
+
+void PidWindows::expire(uint32_t now) {
+	for (auto& w : m_windows)
+		expire(w, now);
+}
+
+float PidWindows::quantile(const Window& w, float q, float lo, float hi) const {
+	float target = q * w.count;
+	float width = (m_hi - m_lo) / AGG_BINS;
+	uint32_t cum = 0;
+	for (size_t b = 0; b < AGG_BINS; b++) {
+		if (w.hist[b] && cum + w.hist[b] >= target) {
+			float v = m_lo + (b + (target - cum) / w.hist[b]) * width;
+			//The exact extremes beat the bin resolution
+			return v < lo ? lo : v > hi ? hi : v;
+		}
+		cum += w.hist[b];
+	}
+	return hi;
+}
+
+WindowStats PidWindows::stats(size_t window) const {
+	const Window& w = m_windows[window];
+	WindowStats st;
+	memset(&st, 0, sizeof(st));
+	if (!w.count)
+		return st;
+	//The closed buckets are in the deques, the current one is not
+	const Bucket& cur = w.at(w.next - 1);
+	st.count = w.count < 0xFFFF ? w.count : 0xFFFF;
+	st.min = cur.min;
+	st.max = cur.max;
+	if (!w.mins.empty() && w.buckets[w.mins.front()].min < st.min)
+		st.min = w.buckets[w.mins.front()].min;
+	if (!w.maxs.empty() && w.buckets[w.maxs.front()].max > st.max)
+		st.max = w.buckets[w.maxs.front()].max;
+	st.mean = w.sum / w.count;
+	st.p50 = quantile(w, 0.5f, st.min, st.max);
+	st.p90 = quantile(w, 0.9f, st.min, st.max);
+	st.p99 = quantile(w, 0.99f, st.min, st.max);
+	return st;
+}
+
+Aggregator::Aggregator() : m_len(0) {
+	memset(m_slot, NOSLOT, sizeof(m_slot));
+}
+
+void Aggregator::add(uint8_t pid, uint32_t ts, float value) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	uint8_t slot = m_slot[pid];
+	if (slot == NOSLOT) {
+		if (m_len == AGG_MAX_PIDS)
+			return;
+		const PidInfo* info = pidInfo(pid);
+		slot = m_slot[pid] = m_len++;
+		m_pids[slot].reset(pid, info ? info->lo : 0, info ? info->hi : 255);
+	}
+	m_pids[slot].add(ts, value);
+}
+
+size_t Aggregator::snapshot(uint32_t now, uint8_t* pids, WindowStats* out, size_t max) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	size_t n = 0;
+	for (; n < m_len && n < max; n++) {
+		PidWindows& p = m_pids[n];
+		p.expire(now);
+		pids[n] = p.pid();
+		for (size_t w = 0; w < AGG_WINDOWS; w++)
+			out[n * AGG_WINDOWS + w] = p.stats(w);
+	}
+	return n;
+}
+
+}
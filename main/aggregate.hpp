@@ -0,0 +1,150 @@
+/*
+ * aggregate.hpp
+ *
+ *  Sliding-window statistics per PID over the last 1, 10 and 60 seconds.
+ *
+ *  Each window of a PID is split into AGG_SLOTS time buckets, a tenth of
+ *  its duration each, holding count, sum, min, max and a fixed-bin
+ *  histogram of their samples. The window keeps running totals of the
+ *  buckets and monotonic deques over the min/max of the closed ones, so a
+ *  bucket is added and expired in O(1) whatever the sample rate. A window
+ *  covers whole buckets: the current one and those that started within
+ *  its duration, between 90% and 100% of it. All memory is preallocated.
+ */
+
+#ifndef MAIN_AGGREGATE_HPP_
+#define MAIN_AGGREGATE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+#include "templates.hpp"
+
+namespace ecuspy {
+
+constexpr size_t AGG_MAX_PIDS = 8;
+constexpr size_t AGG_SLOTS = 10;
+constexpr size_t AGG_BINS = 16;
+constexpr size_t AGG_WINDOWS = 3;
+constexpr uint32_t AGG_WINDOW_MS[AGG_WINDOWS] = {1000, 10000, 60000};
+
+struct WindowStats {
+	uint16_t count;
+	float min;
+	float max;
+	float mean;
+	float p50;
+	float p90;
+	float p99;
+};
+
+/**
+ * Fixed capacity deque of bucket slots, kept monotonic by the caller.
+ * Slots are below AGG_SLOTS, so a byte each is enough.
+ */
+template<size_t N>
+class MonoDeque {
+public:
+	MonoDeque() : m_head(0), m_len(0) {}
+
+	bool empty() const { return !m_len; }
+	uint8_t front() const { return m_pos[m_head]; }
+	uint8_t back() const { return m_pos[(m_head + m_len - 1) % N]; }
+	void popFront() { m_head = (m_head + 1) % N; m_len--; }
+	void popBack() { m_len--; }
+	void pushBack(uint8_t pos) { m_pos[(m_head + m_len++) % N] = pos; }
+	void clear() { m_head = m_len = 0; }
+
+private:
+	uint8_t m_pos[N];
+	uint16_t m_head;
+	uint16_t m_len;
+};
+
+static_assert(AGG_SLOTS <= 256, "bucket slots have to fit a byte");
+
+class PidWindows {
+public:
+	PidWindows() : m_pid(0), m_lo(0), m_hi(1) {}
+
+	void reset(uint8_t pid, float lo, float hi);
+	void add(uint32_t ts, float value);
+	void expire(uint32_t now);
+	WindowStats stats(size_t window) const;
+
+	uint8_t pid() const { return m_pid; }
+
+private:
+	struct Bucket {
+		//Start time / bucket width
+		uint32_t index;
+		uint32_t count;
+		float min;
+		float max;
+		double sum;
+		uint16_t hist[AGG_BINS];
+	};
+
+	/**
+	 * Buckets first..next-1 are live, next-1 is the one being filled and
+	 * the only one not in the deques yet.
+	 */
+	struct Window {
+		uint32_t width;
+		uint32_t first;
+		uint32_t next;
+		uint32_t count;
+		double sum;
+		uint32_t hist[AGG_BINS];
+		Bucket buckets[AGG_SLOTS];
+		MonoDeque<AGG_SLOTS> mins;
+		MonoDeque<AGG_SLOTS> maxs;
+
+		Bucket& at(uint32_t seq) { return buckets[seq % AGG_SLOTS]; }
+		const Bucket& at(uint32_t seq) const { return buckets[seq % AGG_SLOTS]; }
+	};
+
+	size_t bin(float value) const;
+	void open(Window& w, uint32_t index);
+	void close(Window& w);
+	void drop(Window& w);
+	void expire(Window& w, uint32_t now);
+	float quantile(const Window& w, float q, float lo, float hi) const;
+
+	uint8_t m_pid;
+	float m_lo;
+	float m_hi;
+	Window m_windows[AGG_WINDOWS];
+};
+
+class Aggregator : public tpl::Singleton<Aggregator> {
+public:
+	/**
+	 * Feed one sample. PIDs get a slot on their first sample, samples of
+	 * PIDs beyond AGG_MAX_PIDS are ignored.
+	 */
+	void add(uint8_t pid, uint32_t ts, float value);
+
+	/**
+	 * Statistics of every tracked PID at time now, out holds
+	 * AGG_WINDOWS entries per PID. Returns the number of PIDs.
+	 */
+	size_t snapshot(uint32_t now, uint8_t* pids, WindowStats* out, size_t max);
+
+private:
+	friend class Singleton<Aggregator>;
+
+	Aggregator();
+
+	static constexpr uint8_t NOSLOT = 0xFF;
+
+	uint8_t m_slot[256];
+	size_t m_len;
+	PidWindows m_pids[AGG_MAX_PIDS];
+	std::mutex m_lock;
+};
+
+}
+
+#endif /* MAIN_AGGREGATE_HPP_ */
@@ -0,0 +1,232 @@
+/*
+ * cfgcbor.cpp
+ *
+ *  CBOR encoding of the Config store, see cfgcbor.hpp for the layout.
+ */
+
+#include "cfgcbor.hpp"
+#include "config.hpp"
+
+namespace ecuspy {
+
+namespace {
+
+enum CborMajor_t {
+	cborUint = 0,
+	cborText = 3,
+	cborMap = 5
+};
+
+size_t headSize(uint64_t v) {
+	return v < 24 ? 1 : v < 0x100 ? 2 : v < 0x10000 ? 3 : v < 0x100000000ULL ? 5 : 9;
+}
+
+size_t putHead(uint8_t* p, uint8_t major, uint64_t v) {
+	size_t n = headSize(v);
+	static const uint8_t ai[] = {0, 0, 24, 25, 0, 26, 0, 0, 0, 27};
+	p[0] = (major << 5) | (n == 1 ? v : ai[n]);
+	for (size_t i = 1; i < n; i++)
+		p[i] = v >> (8 * (n - 1 - i));
+	return n;
+}
+
+//Length of a head from its initial byte, 0 for what this parser does not accept
+size_t headLen(uint8_t ib) {
+	uint8_t ai = ib & 0x1F;
+	if (ai < 24)
+		return 1;
+	if (ai > 27)
+		return 0;
+	return 1 + (1 << (ai - 24));
+}
+
+uint32_t fnv(uint32_t h, const void* data, size_t len) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+}
+
+uint32_t configSchemaHash() {
+	Config& cfg = Config::instance();
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < cfg.size(); i++) {
+		const ConfigEntry& e = cfg.entry(i);
+		uint32_t type = e.type;
+		uint32_t len = e.value_len;
+		h = fnv(h, e.id, strlen(e.id) + 1);
+		h = fnv(h, &type, sizeof(type));
+		h = fnv(h, &len, sizeof(len));
+	}
+	return h;
+}
+
+size_t CborExporter::next(uint8_t* buf, size_t len) {
+	Config& cfg = Config::instance();
+	size_t pos = 0;
+
+	if (!m_header) {
+		if (len < 13)
+			return 0;
+		pos += putHead(buf + pos, cborMap, 2);
+		pos += putHead(buf + pos, cborUint, 0);
+		pos += putHead(buf + pos, cborUint, configSchemaHash());
+		pos += putHead(buf + pos, cborUint, 1);
+		pos += putHead(buf + pos, cborMap, cfg.size());
+		m_header = true;
+	}
+
+	for (; m_index < cfg.size(); m_index++) {
+		const char* v = cfg.getValueStr(m_index);
+		size_t vlen = strlen(v);
+		if (pos + headSize(m_index) + headSize(vlen) + vlen > len)
+			break;
+		pos += putHead(buf + pos, cborUint, m_index);
+		pos += putHead(buf + pos, cborText, vlen);
+		memcpy(buf + pos, v, vlen);
+		pos += vlen;
+	}
+	return pos;
+}
+
+bool CborExporter::done() const {
+	return m_header && m_index >= Config::instance().size();
+}
+
+CborImporter::CborImporter()
+: m_state(sTop),
+  m_status(cborMore),
+  m_head_len(0),
+  m_remaining(0),
+  m_index(0),
+  m_str_len(0),
+  m_str_pos(0),
+  m_entries(0) {
+	Config& cfg = Config::instance();
+	size_t size = 0;
+	m_offsets.reset(new size_t[cfg.size()]);
+	m_present.reset(new bool[cfg.size()]);
+	for (size_t i = 0; i < cfg.size(); i++) {
+		m_offsets[i] = size;
+		m_present[i] = false;
+		size += cfg.entry(i).value_len + 1;
+	}
+	m_values.reset(new char[size]);
+}
+
+CborStatus_t CborImporter::feed(const uint8_t* data, size_t len) {
+	size_t i = 0;
+	while (i < len && m_status == cborMore) {
+		if (m_state == sString) {
+			size_t n = m_str_len - m_str_pos;
+			if (n > len - i)
+				n = len - i;
+			memcpy(m_values.get() + m_offsets[m_index] + m_str_pos, data + i, n);
+			m_str_pos += n;
+			i += n;
+			if (m_str_pos == m_str_len)
+				m_status = finishValue();
+			continue;
+		}
+
+		m_head[m_head_len++] = data[i++];
+		size_t need = headLen(m_head[0]);
+		if (!need) {
+			m_status = cborMalformed;
+			break;
+		}
+		if (m_head_len < need)
+			continue;
+		uint64_t arg = need == 1 ? m_head[0] & 0x1F : 0;
+		for (size_t j = 1; j < need; j++)
+			arg = (arg << 8) | m_head[j];
+		m_head_len = 0;
+		m_status = head(m_head[0] >> 5, arg);
+	}
+	//Anything after the document is an error too
+	if (m_status == cborDone && i < len)
+		m_status = cborMalformed;
+	return m_status;
+}
+
+CborStatus_t CborImporter::head(uint8_t major, uint64_t arg) {
+	Config& cfg = Config::instance();
+	switch (m_state) {
+	case sTop:
+		if (major != cborMap || arg != 2)
+			return cborMalformed;
+		m_state = sSchemaKey;
+		return cborMore;
+
+	case sSchemaKey:
+	case sValuesKey:
+		if (major != cborUint || arg != (m_state == sSchemaKey ? 0 : 1))
+			return cborMalformed;
+		m_state = m_state == sSchemaKey ? sSchema : sValues;
+		return cborMore;
+
+	case sSchema:
+		if (major != cborUint)
+			return cborMalformed;
+		if (arg != configSchemaHash())
+			return cborBadSchema;
+		m_state = sValuesKey;
+		return cborMore;
+
+	case sValues:
+		if (major != cborMap)
+			return cborMalformed;
+		m_remaining = arg;
+		m_state = m_remaining ? sIndex : sDone;
+		return m_remaining ? cborMore : cborDone;
+
+	case sIndex:
+		if (major != cborUint)
+			return cborMalformed;
+		if (arg >= cfg.size() || m_present[arg])
+			return cborBadIndex;
+		m_index = arg;
+		m_state = sValue;
+		return cborMore;
+
+	case sValue:
+		if (major != cborText)
+			return cborMalformed;
+		if (arg > cfg.entry(m_index).value_len)
+			return cborInvalidValue;
+		m_str_len = arg;
+		m_str_pos = 0;
+		m_state = sString;
+		return m_str_len ? cborMore : finishValue();
+
+	default:
+		return cborMalformed;
+	}
+}
+
+CborStatus_t CborImporter::finishValue() {
+	char* v = m_values.get() + m_offsets[m_index];
+	v[m_str_len] = 0;
+	if (m_str_len && !Config::instance().validate(m_index, v))
+		return cborInvalidValue;
+	m_present[m_index] = true;
+	m_entries++;
+	m_state = --m_remaining ? sIndex : sDone;
+	return m_remaining ? cborMore : cborDone;
+}
+
+bool CborImporter::commit() {
+	if (m_status != cborDone)
+		return false;
+	Config& cfg = Config::instance();
+	Transaction tr;
+	for (size_t i = 0; i < cfg.size(); i++) {
+		if (m_present[i])
+			cfg.setValueStr(i, m_values.get() + m_offsets[i]);
+	}
+	return true;
+}
+
+}
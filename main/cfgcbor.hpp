@@ -0,0 +1,109 @@
+/*
+ * cfgcbor.hpp
+ *
+ *  Compact binary export/import of the whole Config store as CBOR:
+ *
+ *      { 0: schema hash (uint), 1: { index (uint): value (text), ... } }
+ *
+ *  The schema hash covers id, type and length of every ConfigEntry, so a
+ *  document is only accepted by firmware with the same entry table. Unset
+ *  entries are exported as empty text, and an empty value imports as
+ *  unset without going through the entry's validator.
+ */
+
+#ifndef MAIN_CFGCBOR_HPP_
+#define MAIN_CFGCBOR_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+namespace ecuspy {
+
+uint32_t configSchemaHash();
+
+/**
+ * Streams the document out in pieces of any size, at least as large as
+ * the largest encoded entry (value_len + 9 bytes).
+ */
+class CborExporter {
+public:
+	CborExporter() : m_index(0), m_header(false) {}
+
+	/**
+	 * Encode as much as fits into buf. Returns the number of bytes
+	 * written; 0 either once the document is complete or when buf is too
+	 * small for the next entry, done() tells which.
+	 */
+	size_t next(uint8_t* buf, size_t len);
+
+	bool done() const;
+
+private:
+	size_t m_index;
+	bool m_header;
+};
+
+enum CborStatus_t {
+	cborMore,
+	cborDone,
+	cborMalformed,
+	cborBadSchema,
+	cborBadIndex,
+	cborInvalidValue
+};
+
+/**
+ * Push parser: feed() takes the document in arbitrary pieces and checks
+ * every value with Config::validate as soon as it is complete. Nothing
+ * touches the store until commit(), which applies all values in one
+ * Transaction.
+ */
+class CborImporter {
+public:
+	CborImporter();
+
+	CborStatus_t feed(const uint8_t* data, size_t len);
+
+	/**
+	 * Apply the staged values. Only valid after feed() returned cborDone.
+	 */
+	bool commit();
+
+	size_t entries() const {
+		return m_entries;
+	}
+
+private:
+	enum State_t {
+		sTop,
+		sSchemaKey,
+		sSchema,
+		sValuesKey,
+		sValues,
+		sIndex,
+		sValue,
+		sString,
+		sDone
+	};
+
+	CborStatus_t head(uint8_t major, uint64_t arg);
+	CborStatus_t finishValue();
+
+	State_t m_state;
+	CborStatus_t m_status;
+	uint8_t m_head[9];
+	size_t m_head_len;
+	size_t m_remaining;
+	size_t m_index;
+	size_t m_str_len;
+	size_t m_str_pos;
+	size_t m_entries;
+	std::unique_ptr<size_t[]> m_offsets;
+	std::unique_ptr<char[]> m_values;
+	std::unique_ptr<bool[]> m_present;
+};
+
+}
+
+#endif /* MAIN_CFGCBOR_HPP_ */
@@ -0,0 +1,42 @@
+/*
+ * cgi-adapters.cpp
+ *
+ *  /adapters.json: per-session request rate, latency and error counts,
+ *  plus the samples the merge dropped for arriving too late.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+#include "cgi-adapters.h"
+}
+#include "session.hpp"
+#include "merge.hpp"
+
+using namespace ecuspy;
+
+CgiStatus ICACHE_FLASH_ATTR cgiAdapterStats(HttpdConnData *connData) {
+	SessionStats st[MERGE_MAX_SOURCES];
+	char buff[192];
+	int l;
+
+	if (connData->conn==NULL) {
+		return HTTPD_CGI_DONE;
+	}
+
+	size_t n = sessionStats(st, tpl::countof(st));
+	httpdStartResponse(connData, 200);
+	httpdHeader(connData, "content-type", "application/json");
+	httpdEndHeaders(connData);
+	httpdSend(connData, "{\"sessions\":[", -1);
+	for (size_t i = 0; i < n; i++) {
+		l = snprintf(buff, sizeof(buff),
+				"%s{\"name\":\"%s\",\"requests\":%u,\"responses\":%u,\"errors\":%u,\"samples\":%u,"
+				"\"commands\":%u,\"avg_us\":%u,\"max_us\":%u,\"rate\":%u.%02u}",
+				i ? "," : "", st[i].name, st[i].requests, st[i].responses, st[i].errors, st[i].samples,
+				st[i].commands, st[i].avg_us, st[i].max_us, st[i].rate / 100, st[i].rate % 100);
+		httpdSend(connData, buff, l);
+	}
+	l = snprintf(buff, sizeof(buff), "],\"late\":%u}", SampleMerger::instance().late());
+	httpdSend(connData, buff, l);
+	return HTTPD_CGI_DONE;
+}
@@ -0,0 +1,8 @@
+#ifndef CGI_ADAPTERS_H
+#define CGI_ADAPTERS_H
+
+#include "libesphttpd/httpd.h"
+
+CgiStatus cgiAdapterStats(HttpdConnData *connData);
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ * cgi-config.cpp
+ *
+ *  HTTP access to the Config store: /config.json dumps every entry,
+ *  /config/set.cgi takes a form with id=value pairs, /config.cbor exports
+ *  (GET) or imports (POST) the whole store as CBOR.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+#include "cgi-config.h"
+}
+#include "config.hpp"
+#include "cfgcbor.hpp"
+
+#include <string.h>
+
+#ifdef ESP32
+#include "esp_timer.h"
+#endif
+
+using namespace ecuspy;
+
+typedef struct {
+	size_t pos;
+	//Bytes of the current entry's value already sent
+	size_t off;
+} JsonState;
+
+//Entries are streamed a buffer at a time so a big store never needs a big buffer; a value that
+//does not fit is split across calls
+CgiStatus ICACHE_FLASH_ATTR cgiGetConfigJson(HttpdConnData *connData) {
+	char buff[256];
+	Config& cfg = Config::instance();
+	JsonState *state = (JsonState*)connData->cgiData;
+	size_t l = 0;
+
+	if (connData->conn==NULL) {
+		//Connection aborted. Clean up.
+		delete state;
+		return HTTPD_CGI_DONE;
+	}
+
+	if (state == NULL) {
+		state = new JsonState();
+		state->pos = 0;
+		state->off = 0;
+		connData->cgiData = state;
+		httpdStartResponse(connData, 200);
+		httpdHeader(connData, "content-type", "application/json");
+		httpdEndHeaders(connData);
+		buff[l++] = '{';
+	}
+
+	while (state->pos < cfg.size()) {
+		const char* v = cfg.getValueStr(state->pos);
+		//The value may have been set shorter since the last call
+		size_t vl = strlen(v);
+		if (state->off > vl)
+			state->off = vl;
+		v += state->off;
+		if (state->off == 0) {
+			//Room for the key and at least one escaped character
+			if (l && l + strlen(cfg.entry(state->pos).id) + 12 > sizeof(buff))
+				break;
+			l += snprintf(buff + l, sizeof(buff) - l, "%s\"%s\":\"", state->pos ? "," : "",
+					cfg.entry(state->pos).id);
+		}
+		for (; *v && l < sizeof(buff) - 8; v++, state->off++) {
+			if (*v == '"' || *v == '\\') {
+				buff[l++] = '\\';
+				buff[l++] = *v;
+			} else if ((unsigned char)*v < 0x20)
+				l += sprintf(buff + l, "\\u%04x", *v);
+			else
+				buff[l++] = *v;
+		}
+		if (*v)
+			break;
+		buff[l++] = '"';
+		state->pos++;
+		state->off = 0;
+	}
+	if (state->pos < cfg.size()) {
+		//Give the send buffer a chance to drain
+		httpdSend(connData, buff, l);
+		return HTTPD_CGI_MORE;
+	}
+	buff[l++] = '}';
+	httpdSend(connData, buff, l);
+	delete state;
+	connData->cgiData = NULL;
+	return HTTPD_CGI_DONE;
+}
+
+//Largest form /config/set.cgi takes, every value at its longest fits with room to spare
+#define CONFIG_POST_MAX 2048
+
+typedef struct {
+	char body[CONFIG_POST_MAX + 1];
+	int len;
+	bool tooLong;
+} FormState;
+
+static CgiStatus ICACHE_FLASH_ATTR cgiSetConfigError(HttpdConnData *connData, int code, const char* msg) {
+	httpdStartResponse(connData, code);
+	httpdHeader(connData, "content-type", "text/plain");
+	httpdEndHeaders(connData);
+	httpdSend(connData, msg, -1);
+	return HTTPD_CGI_DONE;
+}
+
+//Applies every known id found in the POSTed form in one transaction, or none of them. The form
+//can come in several POST buffers, it is parsed once all of it is there.
+CgiStatus ICACHE_FLASH_ATTR cgiSetConfig(HttpdConnData *connData) {
+	char buff[128];
+	Config& cfg = Config::instance();
+	FormState *state = (FormState*)connData->cgiData;
+	int l;
+
+	if (connData->conn==NULL) {
+		//Connection aborted. Clean up.
+		delete state;
+		return HTTPD_CGI_DONE;
+	}
+
+	if (state == NULL) {
+		state = new FormState();
+		state->len = 0;
+		state->tooLong = connData->post->len > CONFIG_POST_MAX;
+		connData->cgiData = state;
+	}
+
+	//An oversized form is still read to the end, the answer is sent once it is consumed
+	if (state->len + connData->post->buffLen > CONFIG_POST_MAX)
+		state->tooLong = true;
+	if (!state->tooLong && connData->post->buffLen > 0) {
+		memcpy(state->body + state->len, connData->post->buff, connData->post->buffLen);
+		state->len += connData->post->buffLen;
+	}
+	if (connData->post->received < connData->post->len) {
+		//Still receiving data.
+		return HTTPD_CGI_MORE;
+	}
+	state->body[state->len] = 0;
+	connData->cgiData = NULL;
+
+	if (state->tooLong) {
+		delete state;
+		return cgiSetConfigError(connData, 413, "Form too long");
+	}
+
+	for (size_t i = 0; i < cfg.size(); i++) {
+		l = httpdFindArg(state->body, (char*)cfg.entry(i).id, buff, sizeof(buff));
+		if (l != -1 && !cfg.validate(i, buff)) {
+			delete state;
+			snprintf(buff, sizeof(buff), "Invalid value for %s", cfg.entry(i).id);
+			return cgiSetConfigError(connData, 400, buff);
+		}
+	}
+
+	{
+		Transaction tr;
+		for (size_t i = 0; i < cfg.size(); i++) {
+			l = httpdFindArg(state->body, (char*)cfg.entry(i).id, buff, sizeof(buff));
+			if (l != -1)
+				cfg.setValueStr(i, buff);
+		}
+	}
+	delete state;
+
+	httpdStartResponse(connData, 200);
+	httpdHeader(connData, "content-type", "text/plain");
+	httpdEndHeaders(connData);
+	httpdSend(connData, "OK", 2);
+	return HTTPD_CGI_DONE;
+}
+
+static const char* cborErrors[] = {
+	"", "", "Malformed document", "Schema mismatch", "Bad index", "Invalid value"
+};
+
+static int64_t ICACHE_FLASH_ATTR cgiTimeUs() {
+#ifdef ESP32
+	return esp_timer_get_time();
+#else
+	return 0;
+#endif
+}
+
+typedef struct {
+	CborExporter exporter;
+	CborImporter *importer;
+	int64_t parseUs;
+} CborState;
+
+//Export streams the store in send-buffer sized pieces, import is parsed as the POST data comes in
+CgiStatus ICACHE_FLASH_ATTR cgiConfigCbor(HttpdConnData *connData) {
+	uint8_t buff[1024];
+	CborState *state=(CborState*)connData->cgiData;
+	int l;
+
+	if (connData->conn==NULL) {
+		//Connection aborted. Clean up.
+		if (state) {
+			delete state->importer;
+			delete state;
+		}
+		return HTTPD_CGI_DONE;
+	}
+
+	if (state==NULL) {
+		state=new CborState();
+		state->importer=NULL;
+		state->parseUs=0;
+		connData->cgiData=state;
+		if (connData->requestType==HTTPD_METHOD_GET) {
+			httpdStartResponse(connData, 200);
+			httpdHeader(connData, "content-type", "application/cbor");
+			httpdEndHeaders(connData);
+			return HTTPD_CGI_MORE;
+		}
+		state->importer=new CborImporter();
+	}
+
+	if (connData->requestType==HTTPD_METHOD_GET) {
+		l=state->exporter.next(buff, sizeof(buff));
+		if (l) {
+			httpdSend(connData, (const char*)buff, l);
+			return HTTPD_CGI_MORE;
+		}
+		if (!state->exporter.done()) {
+			//An entry larger than buff, the document can't be finished
+			printf("Config export: entry too large\n");
+		}
+		delete state;
+		connData->cgiData=NULL;
+		return HTTPD_CGI_DONE;
+	}
+
+	int64_t t=cgiTimeUs();
+	CborStatus_t rc=state->importer->feed((const uint8_t*)connData->post->buff, connData->post->buffLen);
+	state->parseUs+=cgiTimeUs()-t;
+	if (rc==cborMore && connData->post->received<connData->post->len) {
+		//Still receiving data.
+		return HTTPD_CGI_MORE;
+	}
+
+	if (rc==cborDone) {
+		t=cgiTimeUs();
+		state->importer->commit();
+		state->parseUs+=cgiTimeUs()-t;
+		httpdStartResponse(connData, 200);
+		httpdHeader(connData, "content-type", "text/plain");
+		httpdEndHeaders(connData);
+		l=snprintf((char*)buff, sizeof(buff), "%u entries, %d bytes, %lld us",
+				(unsigned)state->importer->entries(), connData->post->len, (long long)state->parseUs);
+	} else {
+		httpdStartResponse(connData, 400);
+		httpdHeader(connData, "content-type", "text/plain");
+		httpdEndHeaders(connData);
+		l=snprintf((char*)buff, sizeof(buff), "%s", rc==cborMore ? "Truncated document" : cborErrors[rc]);
+	}
+	httpdSend(connData, (const char*)buff, l);
+	delete state->importer;
+	delete state;
+	connData->cgiData=NULL;
+	return HTTPD_CGI_DONE;
+}
@@ -0,0 +1,10 @@
+#ifndef CGI_CONFIG_H
+#define CGI_CONFIG_H
+
+#include "libesphttpd/httpd.h"
+
+CgiStatus cgiGetConfigJson(HttpdConnData *connData);
+CgiStatus cgiSetConfig(HttpdConnData *connData);
+CgiStatus cgiConfigCbor(HttpdConnData *connData);
+
+#endif
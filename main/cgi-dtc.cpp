@@ -0,0 +1,94 @@
+/*
+ * cgi-dtc.cpp
+ *
+ *  /dtc.json: the DTC cache, never the bus. The cache version is the ETag,
+ *  a request with a matching If-None-Match gets an empty 304.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+#include "cgi-dtc.h"
+}
+#include "dtc.hpp"
+#include "obd.hpp"
+
+using namespace ecuspy;
+
+typedef struct {
+	DtcSnapshot snap;
+	size_t ecu;
+} DtcState;
+
+static const char *dtcKindNames[dtcKinds]={"stored", "pending", "permanent"};
+
+static int ICACHE_FLASH_ATTR dtcEcuJson(const EcuDtcs &e, bool first, char *buff, int len) {
+	char code[6];
+	int l=snprintf(buff, len, "%s{\"ecu\":\"%03X\",\"mil\":%s", first ? "" : ",", e.ecu, e.mil ? "true" : "false");
+	for (int k=0; k<dtcKinds; k++) {
+		l+=snprintf(buff+l, len-l, ",\"%s\":[", dtcKindNames[k]);
+		for (size_t c=0; c<e.count[k]; c++) {
+			dtcFormat(e.codes[k][c], code);
+			l+=snprintf(buff+l, len-l, "%s\"%s\"", c ? "," : "", code);
+		}
+		l+=snprintf(buff+l, len-l, "]");
+	}
+	if (e.has_frame) {
+		dtcFormat(e.frame.dtc, code);
+		l+=snprintf(buff+l, len-l, ",\"frame\":{\"dtc\":\"%s\"", code);
+		for (size_t p=0; p<e.frame.pids; p++) {
+			const PidInfo *info=pidInfo(e.frame.pid[p]);
+			l+=snprintf(buff+l, len-l, ",\"%s\":%.2f", info ? info->name : "?", e.frame.value[p]);
+		}
+		l+=snprintf(buff+l, len-l, "}");
+	}
+	l+=snprintf(buff+l, len-l, "}");
+	return l<len ? l : len-1;
+}
+
+//One ECU per call, the snapshot is taken once so the document stays consistent
+CgiStatus ICACHE_FLASH_ATTR cgiDtcJson(HttpdConnData *connData) {
+	char buff[768];
+	DtcState *state=(DtcState*)connData->cgiData;
+	int l;
+
+	if (connData->conn==NULL) {
+		//Connection aborted. Clean up.
+		delete state;
+		return HTTPD_CGI_DONE;
+	}
+
+	if (state==NULL) {
+		char etag[16], match[20];
+		snprintf(etag, sizeof(etag), "\"%u\"", (unsigned)DtcCache::instance().version());
+		if (httpdGetHeader(connData, "If-None-Match", match, sizeof(match)) && !strcmp(match, etag)) {
+			httpdStartResponse(connData, 304);
+			httpdHeader(connData, "ETag", etag);
+			httpdEndHeaders(connData);
+			return HTTPD_CGI_DONE;
+		}
+		state=new DtcState();
+		DtcCache::instance().snapshot(state->snap);
+		state->ecu=0;
+		connData->cgiData=state;
+		snprintf(etag, sizeof(etag), "\"%u\"", (unsigned)state->snap.version);
+		httpdStartResponse(connData, 200);
+		httpdHeader(connData, "content-type", "application/json");
+		httpdHeader(connData, "ETag", etag);
+		httpdEndHeaders(connData);
+		l=snprintf(buff, sizeof(buff), "{\"version\":%u,\"ts\":%u,\"ecus\":[",
+				(unsigned)state->snap.version, (unsigned)state->snap.ts);
+		httpdSend(connData, buff, l);
+		return HTTPD_CGI_MORE;
+	}
+
+	if (state->ecu<state->snap.ecus) {
+		l=dtcEcuJson(state->snap.ecu[state->ecu], state->ecu==0, buff, sizeof(buff));
+		httpdSend(connData, buff, l);
+		state->ecu++;
+		return HTTPD_CGI_MORE;
+	}
+	httpdSend(connData, "]}", 2);
+	delete state;
+	connData->cgiData=NULL;
+	return HTTPD_CGI_DONE;
+}
@@ -0,0 +1,8 @@
+#ifndef CGI_DTC_H
+#define CGI_DTC_H
+
+#include "libesphttpd/httpd.h"
+
+CgiStatus cgiDtcJson(HttpdConnData *connData);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * cgi-ota.cpp
+ *
+ *  Firmware update over HTTP: POST the image to /ota/upload.cgi?sha256=<hex>,
+ *  then GET /ota/reboot.cgi to boot into it.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+#include "cgi-ota.h"
+}
+#include "ota.hpp"
+
+#ifdef ESP32
+#include "esp_timer.h"
+#include "esp_system.h"
+#endif
+
+using namespace ecuspy;
+
+typedef struct {
+	//NULL when the request was refused before the update started
+	OtaUpdater *updater;
+	OtaStatus_t status;
+	const char *err;
+	int64_t startUs;
+} OtaState;
+
+static bool otaRunning=false;
+
+static int64_t ICACHE_FLASH_ATTR otaTimeUs() {
+#ifdef ESP32
+	return esp_timer_get_time();
+#else
+	return 0;
+#endif
+}
+
+static bool ICACHE_FLASH_ATTR parseDigest(const char *hex, uint8_t *digest) {
+	if (strlen(hex)!=OTA_DIGEST_LEN*2) return false;
+	for (size_t i=0; i<OTA_DIGEST_LEN*2; i++) {
+		char c=hex[i];
+		int v=c>='0' && c<='9' ? c-'0' : c>='a' && c<='f' ? c-'a'+10 : c>='A' && c<='F' ? c-'A'+10 : -1;
+		if (v<0) return false;
+		digest[i/2]=i%2 ? (digest[i/2]<<4)|v : v;
+	}
+	return true;
+}
+
+static void ICACHE_FLASH_ATTR otaFree(OtaState *state) {
+	if (state->updater) {
+		delete state->updater;
+		otaRunning=false;
+	}
+	delete state;
+}
+
+//Data goes to the updater as it arrives; after an error, also one that refuses the request up front,
+//the rest of the POST is drained before answering
+CgiStatus ICACHE_FLASH_ATTR cgiOtaUpload(HttpdConnData *connData) {
+	char buff[128];
+	OtaState *state=(OtaState*)connData->cgiData;
+	int l;
+
+	if (connData->conn==NULL) {
+		//Connection aborted. Clean up, the updater drops the partial image.
+		if (state) otaFree(state);
+		return HTTPD_CGI_DONE;
+	}
+
+	if (state==NULL) {
+		uint8_t digest[OTA_DIGEST_LEN];
+		const char *err=NULL;
+		if (connData->requestType!=HTTPD_METHOD_POST) {
+			err="POST the image";
+		} else if (httpdFindArg(connData->getArgs, (char*)"sha256", buff, sizeof(buff))==-1 || !parseDigest(buff, digest)) {
+			err="sha256 argument missing or malformed";
+		} else if (otaRunning) {
+			err=otaStatusStr(otaBusy);
+		}
+		state=new OtaState();
+		state->updater=NULL;
+		state->err=err;
+		state->startUs=otaTimeUs();
+		connData->cgiData=state;
+		if (err==NULL) {
+			otaRunning=true;
+			state->updater=new OtaUpdater(otaFlash());
+			state->status=state->updater->begin(connData->post->len, digest);
+		}
+	}
+
+	if (state->err==NULL && state->status==otaOk) {
+		state->status=state->updater->feed((const uint8_t*)connData->post->buff, connData->post->buffLen);
+	}
+	if (connData->requestType==HTTPD_METHOD_POST && connData->post->received<connData->post->len) {
+		//Still receiving data.
+		return HTTPD_CGI_MORE;
+	}
+
+	if (state->err==NULL && state->status==otaOk) {
+		state->status=state->updater->finish();
+	}
+	httpdStartResponse(connData, state->err==NULL && state->status==otaOk ? 200 : 400);
+	httpdHeader(connData, "content-type", "text/plain");
+	httpdEndHeaders(connData);
+	if (state->err) {
+		l=snprintf(buff, sizeof(buff), "%s", state->err);
+	} else if (state->status==otaOk) {
+		l=snprintf(buff, sizeof(buff), "OK, %u bytes in %lld us, %llu us waiting for flash",
+				(unsigned)state->updater->received(), (long long)(otaTimeUs()-state->startUs),
+				(unsigned long long)state->updater->stallUs());
+	} else {
+		l=snprintf(buff, sizeof(buff), "%s", otaStatusStr(state->status));
+	}
+	httpdSend(connData, buff, l);
+	otaFree(state);
+	connData->cgiData=NULL;
+	return HTTPD_CGI_DONE;
+}
+
+#ifdef ESP32
+static void otaRestart(void *arg) {
+	esp_restart();
+}
+#endif
+
+//Answer first, restart once the response had time to go out
+CgiStatus ICACHE_FLASH_ATTR cgiOtaReboot(HttpdConnData *connData) {
+	if (connData->conn==NULL) {
+		return HTTPD_CGI_DONE;
+	}
+	httpdStartResponse(connData, 200);
+	httpdHeader(connData, "content-type", "text/plain");
+	httpdEndHeaders(connData);
+	httpdSend(connData, "Rebooting", -1);
+#ifdef ESP32
+	static esp_timer_handle_t timer=NULL;
+	if (timer==NULL) {
+		esp_timer_create_args_t args={};
+		args.callback=otaRestart;
+		args.name="otareboot";
+		esp_timer_create(&args, &timer);
+	}
+	esp_timer_start_once(timer, 500000);
+#endif
+	return HTTPD_CGI_DONE;
+}
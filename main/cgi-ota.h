@@ -0,0 +1,9 @@
+#ifndef CGI_OTA_H
+#define CGI_OTA_H
+
+#include "libesphttpd/httpd.h"
+
+CgiStatus cgiOtaUpload(HttpdConnData *connData);
+CgiStatus cgiOtaReboot(HttpdConnData *connData);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * cgi-query.cpp
+ *
+ *  /query.cgi?pids=rpm,speed&from=<ms>&to=<ms>&points=<n>&mode=lttb|minmax|raw
+ *  Chart data from the sample log, downsampled to about points per PID.
+ *  PIDs go by name or number; from and to default to the whole log.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+#include "cgi-query.h"
+}
+#include "query.hpp"
+#include "obd.hpp"
+
+#include <stdlib.h>
+
+using namespace ecuspy;
+
+typedef struct {
+	LogQuery *query;
+	char buff[1024];
+} QueryState;
+
+static_assert(sizeof(((QueryState*)0)->buff)>=QUERY_CHUNK, "LogQuery::next needs QUERY_CHUNK");
+
+static bool ICACHE_FLASH_ATTR parsePids(char *list, uint8_t *pids, size_t *len) {
+	char *save;
+	*len=0;
+	for (char *tok=strtok_r(list, ",", &save); tok; tok=strtok_r(NULL, ",", &save)) {
+		const PidInfo *info=pidByName(tok);
+		char *end;
+		unsigned long pid=info ? info->pid : strtoul(tok, &end, 0);
+		if (*len==QUERY_MAX_PIDS || (!info && (end==tok || *end || pid>0xFF))) return false;
+		pids[(*len)++]=pid;
+	}
+	return *len>0;
+}
+
+static uint32_t ICACHE_FLASH_ATTR argU32(HttpdConnData *connData, const char *name, uint32_t def) {
+	char buff[16];
+	if (httpdFindArg(connData->getArgs, (char*)name, buff, sizeof(buff))==-1) return def;
+	return strtoul(buff, NULL, 0);
+}
+
+//The query runs as the body is sent, one chunk of points per call
+CgiStatus ICACHE_FLASH_ATTR cgiQuery(HttpdConnData *connData) {
+	QueryState *state=(QueryState*)connData->cgiData;
+	int l;
+
+	if (connData->conn==NULL) {
+		//Connection aborted. Clean up.
+		if (state) {
+			delete state->query;
+			delete state;
+		}
+		return HTTPD_CGI_DONE;
+	}
+
+	if (state==NULL) {
+		char buff[64];
+		uint8_t pids[QUERY_MAX_PIDS];
+		size_t len;
+		QueryMode_t mode=queryLttb;
+		if (httpdFindArg(connData->getArgs, (char*)"mode", buff, sizeof(buff))!=-1) {
+			mode=!strcmp(buff, "raw") ? queryRaw : !strcmp(buff, "minmax") ? queryMinMax : queryLttb;
+		}
+		if (httpdFindArg(connData->getArgs, (char*)"pids", buff, sizeof(buff))==-1 || !parsePids(buff, pids, &len)) {
+			httpdStartResponse(connData, 400);
+			httpdHeader(connData, "content-type", "text/plain");
+			httpdEndHeaders(connData);
+			httpdSend(connData, "pids missing or unknown", -1);
+			return HTTPD_CGI_DONE;
+		}
+		state=new QueryState();
+		state->query=new LogQuery(mode, argU32(connData, "from", 0), argU32(connData, "to", UINT32_MAX),
+				pids, len, argU32(connData, "points", 500));
+		connData->cgiData=state;
+		httpdStartResponse(connData, 200);
+		httpdHeader(connData, "content-type", "application/json");
+		httpdEndHeaders(connData);
+	}
+
+	l=state->query->next(state->buff, sizeof(state->buff));
+	if (l) httpdSend(connData, state->buff, l);
+	if (!state->query->done()) return HTTPD_CGI_MORE;
+	delete state->query;
+	delete state;
+	connData->cgiData=NULL;
+	return HTTPD_CGI_DONE;
+}
@@ -0,0 +1,8 @@
+#ifndef CGI_QUERY_H
+#define CGI_QUERY_H
+
+#include "libesphttpd/httpd.h"
+
+CgiStatus cgiQuery(HttpdConnData *connData);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * cgi-router.cpp
+ *
+ *  Trie dispatch of the application routes. httpd only sees one "*" route;
+ *  cgiRouter looks up every route matching the URL, in table order, and
+ *  runs them like httpd's own top-down scan would: a route answering
+ *  HTTPD_CGI_NOTFOUND or HTTPD_CGI_AUTHENTICATED passes on to the next one.
+ *  The route that takes the request is installed as connData->cgi, so
+ *  httpd calls it directly from then on.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+#include "cgi-router.h"
+}
+#include "routetrie.hpp"
+
+using namespace ecuspy;
+
+constexpr size_t ROUTER_MAX_MATCHES = 16;
+
+static const HttpdBuiltInUrl *routerRoutes=NULL;
+static RouteTrie routerTrie;
+
+void ICACHE_FLASH_ATTR routerInit(const HttpdBuiltInUrl *routes) {
+	routerRoutes=routes;
+	routerTrie.clear();
+	for (uint16_t i=0; routes[i].url!=NULL; i++) {
+		routerTrie.insert(routes[i].url, i);
+	}
+}
+
+CgiStatus ICACHE_FLASH_ATTR cgiRouter(HttpdConnData *connData) {
+	uint16_t matches[ROUTER_MAX_MATCHES];
+
+	if (connData->conn==NULL) {
+		//Aborted before any route took the request
+		return HTTPD_CGI_DONE;
+	}
+
+	size_t n=routerTrie.lookup(connData->url, matches, ROUTER_MAX_MATCHES);
+	if (n>ROUTER_MAX_MATCHES) n=ROUTER_MAX_MATCHES;
+	for (size_t i=0; i<n; i++) {
+		const HttpdBuiltInUrl &route=routerRoutes[matches[i]];
+		connData->cgi=route.cgiCb;
+		connData->cgiArg=route.cgiArg;
+		connData->cgiArg2=route.cgiArg2;
+		connData->cgiData=NULL;
+		CgiStatus r=route.cgiCb(connData);
+		if (r!=HTTPD_CGI_NOTFOUND && r!=HTTPD_CGI_AUTHENTICATED) {
+			return r;
+		}
+	}
+	connData->cgi=cgiRouter;
+	return HTTPD_CGI_NOTFOUND;
+}
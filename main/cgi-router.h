@@ -0,0 +1,18 @@
+#ifndef CGI_ROUTER_H
+#define CGI_ROUTER_H
+
+#include "libesphttpd/httpd.h"
+
+/*
+Compile the application route table (ROUTE_END terminated, same semantics as
+builtInUrls) into a trie. Call once before httpdInit.
+*/
+void routerInit(const HttpdBuiltInUrl *routes);
+
+/*
+Install as the only builtInUrls entry: ROUTE_CGI("*", cgiRouter). It picks the
+first matching application route and hands the connection over to it.
+*/
+CgiStatus cgiRouter(HttpdConnData *connData);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * cgi-tasks.cpp
+ *
+ *  /tasks.json: per-task core, priority, CPU time and stack high-water mark.
+ *  /timers.json: period, jitter and overrun histograms of the periodic timers.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+#include "cgi-tasks.h"
+}
+#include "tasks.hpp"
+#include "clock.hpp"
+
+using namespace ecuspy;
+
+//Tasks sent per call, about 100 bytes each
+#define TASKS_PER_CALL 8
+
+typedef struct {
+	TaskStats st[TASK_MAX * 2];
+	size_t len;
+	size_t total;
+	size_t pos;
+} TaskStatsState;
+
+//The stats are taken once and sent a few tasks per call; "total" above the number of
+//entries in "tasks" means the table was cut short
+CgiStatus ICACHE_FLASH_ATTR cgiTaskStats(HttpdConnData *connData) {
+	TaskStatsState *state = (TaskStatsState*)connData->cgiData;
+	char buff[128];
+	int l;
+
+	if (connData->conn==NULL) {
+		//Connection aborted. Clean up.
+		delete state;
+		return HTTPD_CGI_DONE;
+	}
+
+	if (state == NULL) {
+		state = new TaskStatsState();
+		state->total = Topology::instance().stats(state->st, tpl::countof(state->st));
+		state->len = state->total < tpl::countof(state->st) ? state->total : tpl::countof(state->st);
+		state->pos = 0;
+		connData->cgiData = state;
+		httpdStartResponse(connData, 200);
+		httpdHeader(connData, "content-type", "application/json");
+		httpdEndHeaders(connData);
+		httpdSend(connData, "{\"tasks\":[", -1);
+	}
+
+	for (size_t n = 0; n < TASKS_PER_CALL && state->pos < state->len; n++, state->pos++) {
+		const TaskStats& t = state->st[state->pos];
+		l = snprintf(buff, sizeof(buff),
+				"%s{\"name\":\"%s\",\"core\":%d,\"prio\":%u,\"cpu\":%llu,\"pct\":%u,\"stack\":%u}",
+				state->pos ? "," : "", t.name, t.core, t.prio,
+				(unsigned long long)t.cpu, t.cpu_pct, (unsigned)t.stack_free);
+		httpdSend(connData, buff, l);
+	}
+	if (state->pos < state->len)
+		return HTTPD_CGI_MORE;
+
+	l = snprintf(buff, sizeof(buff), "],\"total\":%u}", (unsigned)state->total);
+	httpdSend(connData, buff, l);
+	delete state;
+	connData->cgiData = NULL;
+	return HTTPD_CGI_DONE;
+}
+
+//Sends head followed by the values as a JSON array, in pieces that fit the buffer
+static void ICACHE_FLASH_ATTR histJson(HttpdConnData *connData, const char *head, const uint32_t *values, size_t n) {
+	char buff[128];
+	int l = snprintf(buff, sizeof(buff), "%s[", head);
+	for (size_t i = 0; i < n; i++) {
+		//A value takes at most 11 bytes
+		if (l > (int)sizeof(buff) - 12) {
+			httpdSend(connData, buff, l);
+			l = 0;
+		}
+		l += snprintf(buff + l, sizeof(buff) - l, "%s%u", i ? "," : "", (unsigned)values[i]);
+	}
+	httpdSend(connData, buff, l);
+	httpdSend(connData, "]", 1);
+}
+
+CgiStatus ICACHE_FLASH_ATTR cgiTimerStats(HttpdConnData *connData) {
+	PeriodicStats st[CLOCK_MAX_TIMERS];
+	char buff[256];
+	int l;
+
+	if (connData->conn==NULL) {
+		return HTTPD_CGI_DONE;
+	}
+
+	size_t n = clockTimerStats(st, tpl::countof(st));
+	httpdStartResponse(connData, 200);
+	httpdHeader(connData, "content-type", "application/json");
+	httpdEndHeaders(connData);
+	histJson(connData, "{\"bins_us\":", clockHistBounds, CLOCK_HIST_BINS - 1);
+	httpdSend(connData, ",\"timers\":[", -1);
+	for (size_t i = 0; i < n; i++) {
+		l = snprintf(buff, sizeof(buff),
+				"%s{\"name\":\"%s\",\"period_us\":%u,\"ticks\":%u,\"overruns\":%u,\"missed\":%u,"
+				"\"max_jitter_us\":%u,\"max_overrun_us\":%u",
+				i ? "," : "", st[i].name, (unsigned)st[i].period_us, (unsigned)st[i].ticks, (unsigned)st[i].overruns,
+				(unsigned)st[i].missed, (unsigned)st[i].max_jitter_us, (unsigned)st[i].max_overrun_us);
+		if (l >= (int)sizeof(buff))
+			l = sizeof(buff) - 1;
+		httpdSend(connData, buff, l);
+		histJson(connData, ",\"jitter\":", st[i].jitter, CLOCK_HIST_BINS);
+		histJson(connData, ",\"overrun\":", st[i].overrun, CLOCK_HIST_BINS);
+		httpdSend(connData, "}", 1);
+	}
+	httpdSend(connData, "]}", 2);
+	return HTTPD_CGI_DONE;
+}
@@ -0,0 +1,9 @@
+#ifndef CGI_TASKS_H
+#define CGI_TASKS_H
+
+#include "libesphttpd/httpd.h"
+
+CgiStatus cgiTaskStats(HttpdConnData *connData);
+CgiStatus cgiTimerStats(HttpdConnData *connData);
+
+#endif
@@ -15,17 +15,32 @@ Cgi routines as used by the tests in the html/test subdirectory.
 #include <libesphttpd/esp.h>
 #include "cgi-test.h"
 
+//Largest chunk sent per call. Has to fit in the httpd send buffer (HTTPD_MAX_SENDBUFF_LEN).
+#define TESTBED_MAX_CHUNK 2048
+#define TESTBED_DEF_CHUNK 1024
 
 typedef struct {
 	int len;
 	int sendPos;
+	int chunk;
 } TestbedState;
 
+//Payload for GET requests. Filled once, every chunk is sent straight out of it.
+static char testPattern[TESTBED_MAX_CHUNK];
+static int testPatternValid=0;
+
+static void ICACHE_FLASH_ATTR testbedFillPattern() {
+	int x;
+	//Semi-random data, same scheme as the old per-chunk fill
+	for (x=0; x<TESTBED_MAX_CHUNK; x++) testPattern[x]=((x^(x>>10))&0x1F)+'0';
+	testPatternValid=1;
+}
+
 
 CgiStatus ICACHE_FLASH_ATTR cgiTestbed(HttpdConnData *connData) {
-	char buff[1024];
+	char buff[64];
 	int first=0;
-	int l, x;
+	int l;
 	TestbedState *state=(TestbedState*)connData->cgiData;
 
 	if (connData->conn==NULL) {
@@ -47,22 +62,26 @@ CgiStatus ICACHE_FLASH_ATTR cgiTestbed(HttpdConnData *connData) {
 			httpdStartResponse(connData, 200);
 			httpdHeader(connData, "content-type", "application/data");
 			httpdEndHeaders(connData);
+			if (!testPatternValid) testbedFillPattern();
 			l=httpdFindArg(connData->getArgs, "len", buff, sizeof(buff));
 			state->len=1024;
 			if (l!=-1) state->len=atoi(buff);
+			l=httpdFindArg(connData->getArgs, "chunk", buff, sizeof(buff));
+			state->chunk=TESTBED_DEF_CHUNK;
+			if (l!=-1) state->chunk=atoi(buff);
+			if (state->chunk<1) state->chunk=1;
+			if (state->chunk>TESTBED_MAX_CHUNK) state->chunk=TESTBED_MAX_CHUNK;
 			state->sendPos=0;
 			return HTTPD_CGI_MORE;
 		} else {
-			l=sizeof(buff);
+			l=state->chunk;
 			if (l>(state->len-state->sendPos)) l=(state->len-state->sendPos);
-			//Fill with semi-random data
-			for (x=0; x<l; x++) buff[x]=((x^(state->sendPos>>10))&0x1F)+'0';
-			httpdSend(connData, buff, l);
+			if (l>0) httpdSend(connData, testPattern, l);
 			state->sendPos+=l;
-			printf("Test: Uploaded %d/%d bytes\n", state->sendPos, state->len);
 			if (state->len<=state->sendPos) {
-				if (state) free(state);
-				return HTTPD_CGI_DONE; 
+				free(state);
+				connData->cgiData=NULL;
+				return HTTPD_CGI_DONE;
 			} else {
 				return HTTPD_CGI_MORE;
 			}
@@ -71,7 +90,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiTestbed(HttpdConnData *connData) {
 	if (connData->requestType==HTTPD_METHOD_POST) {
 		if (connData->post->len!=connData->post->received) {
 			//Still receiving data. Ignore this.
-			printf("Test: got %d/%d bytes\n", connData->post->received, connData->post->len);
 			return HTTPD_CGI_MORE;
 		} else {
 			httpdStartResponse(connData, 200);
@@ -79,6 +97,8 @@ CgiStatus ICACHE_FLASH_ATTR cgiTestbed(HttpdConnData *connData) {
 			httpdEndHeaders(connData);
 			l=sprintf(buff, "%d", connData->post->received);
 			httpdSend(connData, buff, l);
+			free(state);
+			connData->cgiData=NULL;
 			return HTTPD_CGI_DONE;
 		}
 	}
@@ -0,0 +1,112 @@
+/*
+Renderer for templates precompiled by tools/tplcompile.c. Literal spans are
+copied from espfs as they are, tokens go through a jump table indexed by the
+id the precompiler assigned, so nothing is scanned or compared per request.
+*/
+
+#include <libesphttpd/esp.h>
+#include "libesphttpd/espfs.h"
+#include "cgi-tplc.h"
+#include "cgi.h"
+
+static const TplcHandler tplcHandlers[]={
+#define TPL_TOKEN(name, handler) handler,
+#include "tpltokens.def"
+#undef TPL_TOKEN
+};
+
+#define TPLC_HANDLERS (sizeof(tplcHandlers)/sizeof(tplcHandlers[0]))
+
+typedef struct {
+	EspFsFile *file;
+	int literal;
+} TplcState;
+
+static CgiStatus ICACHE_FLASH_ATTR tplcDone(HttpdConnData *connData, TplcState *state) {
+	espFsClose(state->file);
+	free(state);
+	connData->cgiData=NULL;
+	return HTTPD_CGI_DONE;
+}
+
+//Output per call, leaves room for the headers in the 2 KB httpd send buffer (HTTPD_MAX_SENDBUFF_LEN)
+#define TPLC_SEND_MAX 1536
+
+//Renders literals and tokens until the next token could overflow TPLC_SEND_MAX. Handler output
+//goes straight to the send buffer, so pending literal bytes are flushed before each handler.
+CgiStatus ICACHE_FLASH_ATTR cgiTplc(HttpdConnData *connData) {
+	char buff[1024];
+	TplcState *state=(TplcState*)connData->cgiData;
+	int len=0;
+	//Bytes handed to httpdSend in this call, tokens counted at TPLC_TOKEN_MAX
+	int sent=0;
+
+	if (connData->conn==NULL) {
+		//Connection aborted. Clean up.
+		if (state) tplcDone(connData, state);
+		return HTTPD_CGI_DONE;
+	}
+
+	if (state==NULL) {
+		char head[sizeof(TPLC_MAGIC)];
+		snprintf(buff, sizeof(buff), "%sc", connData->url);
+		EspFsFile *file=espFsOpen(buff);
+		if (file==NULL) return HTTPD_CGI_NOTFOUND;
+		if (espFsRead(file, head, sizeof(head))!=sizeof(head) || memcmp(head, TPLC_MAGIC, 4)!=0 || head[4]!=TPLC_VERSION) {
+			espFsClose(file);
+			return HTTPD_CGI_NOTFOUND;
+		}
+		state=malloc(sizeof(TplcState));
+		if (state==NULL) {
+			espFsClose(file);
+			return HTTPD_CGI_NOTFOUND;
+		}
+		state->file=file;
+		state->literal=0;
+		connData->cgiData=state;
+		httpdStartResponse(connData, 200);
+		httpdHeader(connData, "Content-Type", "text/html");
+		httpdHeader(connData, "Cache-Control", "no-store, must-revalidate, no-cache, max-age=0");
+		httpdEndHeaders(connData);
+	}
+
+	for (;;) {
+		if (state->literal) {
+			if (len==(int)sizeof(buff)) {
+				httpdSend(connData, buff, len);
+				sent+=len;
+				len=0;
+			}
+			int n=TPLC_SEND_MAX-sent-len;
+			if (n>(int)sizeof(buff)-len) n=sizeof(buff)-len;
+			if (n>state->literal) n=state->literal;
+			if (n==0) break;
+			if (espFsRead(state->file, buff+len, n)!=n) {
+				//Short read inside a literal, the file is truncated
+				if (len) httpdSend(connData, buff, len);
+				return tplcDone(connData, state);
+			}
+			state->literal-=n;
+			len+=n;
+			continue;
+		}
+		if (sent+len+TPLC_TOKEN_MAX>TPLC_SEND_MAX) break;
+		uint8_t seg[2];
+		if (espFsRead(state->file, (char*)seg, 2)!=2) {
+			if (len) httpdSend(connData, buff, len);
+			return tplcDone(connData, state);
+		}
+		int v=seg[0]|(seg[1]<<8);
+		if (v&TPLC_TOKEN) {
+			if (len) httpdSend(connData, buff, len);
+			sent+=len+TPLC_TOKEN_MAX;
+			len=0;
+			v&=~TPLC_TOKEN;
+			if (v<(int)TPLC_HANDLERS) tplcHandlers[v](connData);
+		} else {
+			state->literal=v;
+		}
+	}
+	if (len) httpdSend(connData, buff, len);
+	return HTTPD_CGI_MORE;
+}
@@ -0,0 +1,29 @@
+#ifndef CGI_TPLC_H
+#define CGI_TPLC_H
+
+#include "libesphttpd/httpd.h"
+
+/*
+Precompiled template (.tplc, see tools/tplcompile.c) layout:
+
+    "TPLC" version:u8 segment*
+    segment: u16 little endian, bit 15 set: token id in bits 0..14,
+             clear: length of the literal bytes that follow
+
+Token handlers send their output with httpdSend, at most TPLC_TOKEN_MAX bytes.
+*/
+#define TPLC_MAGIC "TPLC"
+#define TPLC_VERSION 1
+#define TPLC_TOKEN 0x8000
+#define TPLC_MAX_LITERAL 0x7FFF
+#define TPLC_TOKEN_MAX 64
+
+typedef void (*TplcHandler)(HttpdConnData *connData);
+
+/*
+Serves <url>c from espfs, e.g. ROUTE_CGI("/led.tpl", cgiTplc) renders led.tplc.
+Answers HTTPD_CGI_NOTFOUND when there is no precompiled template.
+*/
+CgiStatus cgiTplc(HttpdConnData *connData);
+
+#endif
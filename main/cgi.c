@@ -43,34 +43,16 @@ CgiStatus ICACHE_FLASH_ATTR cgiLed(HttpdConnData *connData) {
 
 
 
-//Template code for the led page.
-CgiStatus ICACHE_FLASH_ATTR tplLed(HttpdConnData *connData, char *token, void **arg) {
-	char buff[128];
-	if (token==NULL) return HTTPD_CGI_DONE;
-
-	strcpy(buff, "Unknown");
-	if (strcmp(token, "ledstate")==0) {
-		if (currLedState) {
-			strcpy(buff, "on");
-		} else {
-			strcpy(buff, "off");
-		}
-	}
-	httpdSend(connData, buff, -1);
-	return HTTPD_CGI_DONE;
+//Token handlers of the precompiled templates, see tpltokens.def.
+void ICACHE_FLASH_ATTR tplLedState(HttpdConnData *connData) {
+	httpdSend(connData, currLedState ? "on" : "off", -1);
 }
 
 static int hitCounter=0;
 
-//Template code for the counter on the index page.
-CgiStatus ICACHE_FLASH_ATTR tplCounter(HttpdConnData *connData, char *token, void **arg) {
-	char buff[128];
-	if (token==NULL) return HTTPD_CGI_DONE;
-
-	if (strcmp(token, "counter")==0) {
-		hitCounter++;
-		sprintf(buff, "%d", hitCounter);
-	}
+void ICACHE_FLASH_ATTR tplHitCounter(HttpdConnData *connData) {
+	char buff[16];
+	hitCounter++;
+	sprintf(buff, "%d", hitCounter);
 	httpdSend(connData, buff, -1);
-	return HTTPD_CGI_DONE;
 }
@@ -4,7 +4,7 @@
 #include "libesphttpd/httpd.h"
 
 CgiStatus cgiLed(HttpdConnData *connData);
-CgiStatus tplLed(HttpdConnData *connData, char *token, void **arg);
-CgiStatus tplCounter(HttpdConnData *connData, char *token, void **arg);
+void tplLedState(HttpdConnData *connData);
+void tplHitCounter(HttpdConnData *connData);
 
 #endif
@@ -0,0 +1,167 @@
+/*
+ * clock.cpp
+ *
+ *  Monotonic clock and periodic timer backends, see clock.hpp.
+ */
+
+#include "clock.hpp"
+
+#include <string.h>
+#include <mutex>
+
+#ifndef ESP32
+#include <time.h>
+#include <errno.h>
+#endif
+
+namespace ecuspy {
+
+const uint32_t clockHistBounds[CLOCK_HIST_BINS - 1] = {10, 50, 100, 500, 1000, 5000, 10000};
+
+namespace {
+
+//Guards the registry and the stats of every timer
+std::mutex s_lock;
+PeriodicTimer* s_timers[CLOCK_MAX_TIMERS];
+size_t s_timers_len;
+
+void record(uint32_t* hist, uint32_t& max, uint32_t us) {
+	size_t bin = 0;
+	while (bin < CLOCK_HIST_BINS - 1 && us >= clockHistBounds[bin])
+		bin++;
+	hist[bin]++;
+	if (us > max)
+		max = us;
+}
+
+}
+
+uint64_t clockUs() {
+#ifdef ESP32
+	return esp_timer_get_time();
+#else
+	//The clock clock_nanosleep() sleeps on
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+PeriodicTimer::PeriodicTimer(const char* name, uint32_t periodUs) : m_next(0), m_registered(false) {
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.name = name;
+	m_stats.period_us = periodUs;
+#ifdef ESP32
+	m_timer = NULL;
+	m_task = NULL;
+#endif
+}
+
+PeriodicTimer::~PeriodicTimer() {
+	std::lock_guard<std::mutex> guard{s_lock};
+	for (size_t i = 0; i < s_timers_len; i++) {
+		if (s_timers[i] == this) {
+			s_timers[i] = s_timers[--s_timers_len];
+			break;
+		}
+	}
+#ifdef ESP32
+	if (m_timer) {
+		esp_timer_stop(m_timer);
+		esp_timer_delete(m_timer);
+	}
+#endif
+}
+
+#ifdef ESP32
+
+void PeriodicTimer::notify(void* arg) {
+	xTaskNotifyGive(static_cast<PeriodicTimer*>(arg)->m_task);
+}
+
+void PeriodicTimer::sleepUntil(uint64_t deadline) {
+	uint64_t now = clockUs();
+	if (deadline <= now)
+		return;
+	if (m_timer && esp_timer_start_once(m_timer, deadline - now) == ESP_OK) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		return;
+	}
+	//No timer to wake us, fall back to the tick, rounded up
+	uint32_t us = portTICK_PERIOD_MS * 1000;
+	vTaskDelay((deadline - now + us - 1) / us);
+}
+
+#else
+
+void PeriodicTimer::sleepUntil(uint64_t deadline) {
+	timespec ts;
+	ts.tv_sec = deadline / 1000000;
+	ts.tv_nsec = deadline % 1000000 * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+		;
+}
+
+#endif
+
+uint32_t PeriodicTimer::wait() {
+	uint64_t now = clockUs();
+	uint32_t period = m_stats.period_us;
+	if (!m_next) {
+		//Set up in the task that waits, esp_timer is not there yet at static init
+#ifdef ESP32
+		esp_timer_create_args_t args = {};
+		args.callback = notify;
+		args.arg = this;
+		args.name = m_stats.name;
+		if (esp_timer_create(&args, &m_timer) != ESP_OK)
+			m_timer = NULL;
+		m_task = xTaskGetCurrentTaskHandle();
+#endif
+		m_next = now;
+	}
+
+	uint32_t advanced = 1;
+	bool slept = false;
+	m_next += period;
+	if (now > m_next) {
+		uint32_t late = now - m_next;
+		uint32_t skipped = late / period;
+		m_next += (uint64_t)skipped * period;
+		advanced += skipped;
+		std::lock_guard<std::mutex> guard{s_lock};
+		m_stats.overruns++;
+		m_stats.missed += skipped;
+		record(m_stats.overrun, m_stats.max_overrun_us, late);
+	} else {
+		sleepUntil(m_next);
+		slept = true;
+	}
+	uint32_t jitter = clockUs() - m_next;
+
+	std::lock_guard<std::mutex> guard{s_lock};
+	if (!m_registered && s_timers_len < CLOCK_MAX_TIMERS) {
+		s_timers[s_timers_len++] = this;
+		m_registered = true;
+	}
+	m_stats.ticks++;
+	//Past the deadline there was no wakeup to be late
+	if (slept)
+		record(m_stats.jitter, m_stats.max_jitter_us, jitter);
+	return advanced;
+}
+
+PeriodicStats PeriodicTimer::stats() {
+	std::lock_guard<std::mutex> guard{s_lock};
+	return m_stats;
+}
+
+size_t clockTimerStats(PeriodicStats* out, size_t max) {
+	std::lock_guard<std::mutex> guard{s_lock};
+	size_t n = s_timers_len < max ? s_timers_len : max;
+	for (size_t i = 0; i < n; i++)
+		out[i] = s_timers[i]->m_stats;
+	return n;
+}
+
+}
@@ -0,0 +1,99 @@
+/*
+ * clock.hpp
+ *
+ *  Monotonic time since boot: esp_timer on the ESP32, CLOCK_MONOTONIC on
+ *  the host build.
+ *
+ *  PeriodicTimer paces a loop on that clock rather than on the 10 ms
+ *  FreeRTOS tick. Deadlines are absolute, start + k * period, so the time
+ *  the loop body takes does not add up as drift. The ESP32 backend arms a
+ *  one-shot esp_timer for the deadline and blocks on a task notification,
+ *  the host one uses clock_nanosleep with TIMER_ABSTIME. If the esp_timer
+ *  cannot be created or armed it falls back to vTaskDelay, at tick
+ *  resolution. Every timer keeps histograms of how late it woke from the
+ *  waits that slept (jitter) and of how far the loop body ran past the next
+ *  deadline (overruns).
+ */
+
+#ifndef MAIN_CLOCK_HPP_
+#define MAIN_CLOCK_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ESP32
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+namespace ecuspy {
+
+uint64_t clockUs();
+
+inline uint32_t clockMs() {
+	return clockUs() / 1000;
+}
+
+constexpr size_t CLOCK_MAX_TIMERS = 8;
+constexpr size_t CLOCK_HIST_BINS = 8;
+
+/**
+ * Upper bounds in us of all but the last histogram bin.
+ */
+extern const uint32_t clockHistBounds[CLOCK_HIST_BINS - 1];
+
+struct PeriodicStats {
+	const char* name;
+	uint32_t period_us;
+	uint32_t ticks;
+	uint32_t overruns;
+	/**
+	 * Deadlines skipped because an overrun lasted whole periods.
+	 */
+	uint32_t missed;
+	uint32_t max_jitter_us;
+	uint32_t max_overrun_us;
+	uint32_t jitter[CLOCK_HIST_BINS];
+	uint32_t overrun[CLOCK_HIST_BINS];
+};
+
+/**
+ * Stats of the timers that have ticked so far, for /timers.json.
+ */
+size_t clockTimerStats(PeriodicStats* out, size_t max);
+
+class PeriodicTimer {
+public:
+	PeriodicTimer(const char* name, uint32_t periodUs);
+	~PeriodicTimer();
+
+	/**
+	 * Sleep until the next deadline, the first call starts the grid.
+	 * Past a deadline it returns at once; deadlines a whole period or
+	 * more behind are skipped. Returns the periods advanced, 1 unless
+	 * some were skipped.
+	 */
+	uint32_t wait();
+
+	PeriodicStats stats();
+
+private:
+	friend size_t clockTimerStats(PeriodicStats* out, size_t max);
+
+	void sleepUntil(uint64_t deadline);
+
+	PeriodicStats m_stats;
+	uint64_t m_next;
+	bool m_registered;
+#ifdef ESP32
+	static void notify(void* arg);
+
+	esp_timer_handle_t m_timer;
+	TaskHandle_t m_task;
+#endif
+};
+
+}
+
+#endif /* MAIN_CLOCK_HPP_ */
@@ -62,9 +62,81 @@ namespace ecuspy {
 //	return cfg[index];
 //}
 
+int Config::addSubscriber(ConfigMask keys, ConfigCallback cb, void* arg, void* queue) {
+	if (!keys)
+		return BADSUBSCRIBER;
+	std::lock_guard<std::mutex> guard{m_lock};
+	for (size_t i = 0; i < CFG_MAX_SUBSCRIBERS; i++) {
+		Subscriber& s = m_subs[i];
+		if (!s.keys.load()) {
+			s.cb = cb;
+			s.arg = arg;
+#ifdef ESP32
+			s.queue = static_cast<QueueHandle_t>(queue);
+#endif
+			s.pending = 0;
+			s.busy = false;
+			//Publishing keys last makes the slot visible to writers
+			s.keys.store(keys, std::memory_order_release);
+			return i;
+		}
+	}
+	return BADSUBSCRIBER;
 }
 
+int Config::subscribe(ConfigMask keys, ConfigCallback cb, void* arg) {
+	return addSubscriber(keys, cb, arg, nullptr);
+}
+
+#ifdef ESP32
+int Config::subscribe(ConfigMask keys, QueueHandle_t queue) {
+	return addSubscriber(keys, nullptr, nullptr, queue);
+}
+#endif
 
+ConfigMask Config::fetchChanges(int handle) {
+	if (handle < 0 || handle >= (int)CFG_MAX_SUBSCRIBERS)
+		return 0;
+	return m_subs[handle].pending.exchange(0);
+}
 
+void Config::unsubscribe(int handle) {
+	if (handle >= 0 && handle < (int)CFG_MAX_SUBSCRIBERS)
+		m_subs[handle].keys.store(0);
+}
 
+/**
+ * Called by writers after the commit, without holding m_lock. Pending bits
+ * are cleared before they are delivered, so a change made while the
+ * callback runs is never mistaken for one it has seen. Whoever holds busy
+ * delivers; everybody else only ORs their bits in and leaves, and the
+ * holder checks for them again after letting go.
+ */
+void Config::notify(ConfigMask changed) {
+	for (size_t i = 0; i < CFG_MAX_SUBSCRIBERS; i++) {
+		Subscriber& s = m_subs[i];
+		ConfigMask bits = s.keys.load(std::memory_order_acquire) & changed;
+		if (!bits)
+			continue;
+#ifdef ESP32
+		if (s.queue) {
+			if (s.pending.fetch_or(bits))
+				continue;
+			int handle = i;
+			//Nothing is posted while bits are pending, don't leave them behind when the post fails
+			if (xQueueSend(s.queue, &handle, 0) != pdTRUE)
+				s.pending.store(0);
+			continue;
+		}
+#endif
+		s.pending.fetch_or(bits);
+		while (s.pending.load() && !s.busy.exchange(true)) {
+			ConfigMask m;
+			while ((m = s.pending.exchange(0)))
+				s.cb(m, s.arg);
+			s.busy.store(false);
+		}
+	}
+}
 
+}
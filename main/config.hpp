@@ -9,11 +9,18 @@
 #define MAIN_CONFIG_HPP_
 
 #include <array>
+#include <functional>
 #include <iostream>
 #include <string.h>
 #include <stdlib.h>
 #include <thread>
 #include <mutex>
+#include <atomic>
+
+#ifdef ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#endif
 
 #include "templates.hpp"
 
@@ -21,7 +28,9 @@ namespace ecuspy {
 
 enum ConfigCat_t{
 	cfgCatWIFI,
-	cfgCatELM327
+	cfgCatELM327,
+	cfgCatSystem,
+	cfgCatAlerts
 };
 
 enum ConfigValueType_t{
@@ -41,16 +50,30 @@ enum ConfigValueType_t{
 };
 
 
+struct ConfigEntry;
+
+using validator=std::function<bool(const ConfigEntry&, const char*)>;
+using validator_fn=bool (*)(const ConfigEntry&, const char*);
+
+/**
+ * Everything a validator needs lives in the base struct: entry tables are
+ * arrays of ConfigEntry, so NumEntry and CustomValidatorEntry get sliced.
+ */
 struct ConfigEntry {
 
 	constexpr ConfigEntry(const char* _id, const char* _name, const char* _desc,
 		ConfigCat_t _cat, ConfigValueType_t _type, size_t _len)
-	: id(_id),name(_name),desc(_desc), cat(_cat), type(_type), value_len(_len), min(0), max(0)
+	: id(_id),name(_name),desc(_desc), cat(_cat), type(_type), value_len(_len), min(0), max(0), check(nullptr)
 	{}
 
 	constexpr ConfigEntry(const char* _id, const char* _name, const char* _desc,
-		ConfigCat_t _cat, ConfigValueType_t _type, size_t _len, int _min, int _max)
-	: id(_id),name(_name),desc(_desc), cat(_cat), type(_type), value_len(_len), min(_min), max(_max)
+		ConfigCat_t _cat, ConfigValueType_t _type, size_t _len, double _min, double _max)
+	: id(_id),name(_name),desc(_desc), cat(_cat), type(_type), value_len(_len), min(_min), max(_max), check(nullptr)
+	{}
+
+	constexpr ConfigEntry(const char* _id, const char* _name, const char* _desc,
+		ConfigCat_t _cat, size_t _len, validator_fn _check)
+	: id(_id),name(_name),desc(_desc), cat(_cat), type(cfgTypeCustom), value_len(_len), min(0), max(0), check(_check)
 	{}
 
 
@@ -60,71 +83,73 @@ struct ConfigEntry {
 	ConfigCat_t cat;
 	ConfigValueType_t type;
 	size_t value_len;
-	int min;
-	int max;
+	double min;
+	double max;
+	validator_fn check;
 };
 
-using validator=std::function<bool(const ConfigEntry&, const char*)>;
-
 template <typename T>
 struct NumEntry : public ConfigEntry {
 
 	constexpr NumEntry(const char* _id, const char* _name, const char* _desc,
 		ConfigCat_t _cat, ConfigValueType_t _type, size_t _len, T _min, T _max)
-	: ConfigEntry(_id, _name, _desc, _cat, _type, _len), min(_min), max(_max) {}
-	T min;
-	T max;
+	: ConfigEntry(_id, _name, _desc, _cat, _type, _len, _min, _max) {}
 };
 
 struct CustomValidatorEntry : public ConfigEntry {
 
 	constexpr CustomValidatorEntry(const char* _id, const char* _name, const char* _desc,
-		ConfigCat_t _cat, size_t _len, const validator& _v)
-	: ConfigEntry(_id, _name, _desc, _cat, cfgTypeCustom, _len), v(_v) {}
-
-	const validator& v;
+		ConfigCat_t _cat, size_t _len, validator_fn _v)
+	: ConfigEntry(_id, _name, _desc, _cat, _len, _v) {}
 };
 
 template<typename T>
 class IntValidator {
 	public:
 		bool operator() (const ConfigEntry& cfg, const char* str) const {
-			const NumEntry<T>& l = static_cast<const NumEntry<T>&>(cfg);
-			T  val = strtoll(str, NULL, 10);
-			return val >= l.min && val <= l.max;
+			char* end;
+			long long val = strtoll(str, &end, 10);
+			return end != str && !*end && val >= cfg.min && val <= cfg.max;
 		}
 };
 
 class RealValidator{
 	public:
 		bool operator() (const ConfigEntry& cfg, const char* str) const {
-			const NumEntry<double>& l = static_cast<const NumEntry<double>&>(cfg);
-			double  val = strtof(str, NULL);
-			return val >= l.min && val <= l.max;
+			char* end;
+			double val = strtod(str, &end);
+			return end != str && !*end && val >= cfg.min && val <= cfg.max;
 		}
-
-	private:
-		double m_min,m_max;
 };
 
 
 const validator cfg_validators[cfgTypeTotal] = {
 		[] (const ConfigEntry& cfg, const char* str)
 			{return !strcmp(str, "true") || !strcmp(str, "false");},
-		IntValidator<uint8_t>{},
 		IntValidator<int8_t>{},
-		IntValidator<uint16_t>{},
+		IntValidator<uint8_t>{},
 		IntValidator<int16_t>{},
-		IntValidator<uint32_t>{},
+		IntValidator<uint16_t>{},
 		IntValidator<int32_t>{},
-		IntValidator<uint64_t>{},
+		IntValidator<uint32_t>{},
 		IntValidator<int64_t>{},
+		IntValidator<uint64_t>{},
 		[] (const ConfigEntry& cfg, const char* str) {return true;},
 		RealValidator{}
 };
 
 constexpr size_t BADINDEX=0xFFFFFFFF;
 
+/**
+ * Change notifications carry one bit per entry index, so only the first
+ * CFG_MAX_ENTRIES entries of a table can be subscribed to.
+ */
+using ConfigMask = uint64_t;
+using ConfigCallback = void (*)(ConfigMask changed, void* arg);
+constexpr size_t CFG_MAX_ENTRIES = 64;
+constexpr size_t CFG_MAX_SUBSCRIBERS = 8;
+constexpr int BADSUBSCRIBER = -1;
+
 class Config : public tpl::Singleton<Config>  {
 public:
 	void initialize(const ConfigEntry* _cfg, size_t len) {
@@ -144,25 +169,41 @@ public:
 		}
 	}
 
+	size_t size() const {
+		return m_len;
+	}
+
+	const ConfigEntry& entry(size_t index) const {
+		return m_cfg[index];
+	}
+
 	const char* getValueStr(size_t index) const {
 		return m_values + m_offsets[index];
 	}
 
 	bool validate(size_t index, const char* str) {
 		ConfigValueType_t type = m_cfg[index].type;
-		if (type == cfgTypeCustom) {
-				const CustomValidatorEntry& e = static_cast<const CustomValidatorEntry&>(m_cfg[index]);
-				return e.v(e, str);
-		} else
+		if (type == cfgTypeCustom)
+				return m_cfg[index].check && m_cfg[index].check(m_cfg[index], str);
+		else
 			return cfg_validators[type](m_cfg[index], str);
 	}
 
 	void setValueStr(size_t index, const char* value) {
-		std::lock_guard<std::mutex> guard{m_lock};
-		if (m_tr_counter)
-			strncpy(m_tr_values + m_offsets[index], value, m_cfg[index].value_len);
-		else
-			strncpy(m_values + m_offsets[index], value, m_cfg[index].value_len);
+		ConfigMask changed = 0;
+		{
+			std::lock_guard<std::mutex> guard{m_lock};
+			if (m_tr_counter)
+				strncpy(m_tr_values + m_offsets[index], value, m_cfg[index].value_len);
+			else {
+				char* v = m_values + m_offsets[index];
+				if (strncmp(v, value, m_cfg[index].value_len))
+					changed = maskOf(index);
+				strncpy(v, value, m_cfg[index].value_len);
+			}
+		}
+		if (changed)
+			notify(changed);
 	}
 
 	void startTransaction() {
@@ -173,12 +214,21 @@ public:
 	}
 
 	void stopTransaction() {
-		std::lock_guard<std::mutex> guard{m_lock};
-		if (m_tr_counter == 1) {
-			memcpy( m_values, m_tr_values, m_values_size);
-			m_tr_counter = 0;
-		} else
-			m_tr_counter--;
+		ConfigMask changed = 0;
+		{
+			std::lock_guard<std::mutex> guard{m_lock};
+			if (m_tr_counter == 1) {
+				for (size_t i = 0; i < m_len && i < CFG_MAX_ENTRIES; i++) {
+					if (strcmp(m_values + m_offsets[i], m_tr_values + m_offsets[i]))
+						changed |= maskOf(i);
+				}
+				memcpy( m_values, m_tr_values, m_values_size);
+				m_tr_counter = 0;
+			} else
+				m_tr_counter--;
+		}
+		if (changed)
+			notify(changed);
 	}
 
 	void abortTransaction() {
@@ -200,6 +250,42 @@ public:
 		return index;
 	}
 
+	static constexpr ConfigMask maskOf(size_t index) {
+		return index < CFG_MAX_ENTRIES ? ConfigMask(1) << index : 0;
+	}
+
+	ConfigMask maskOf(ConfigCat_t cat) const {
+		ConfigMask mask = 0;
+		for (size_t i = 0; i < m_len; i++) {
+			if (m_cfg[i].cat == cat)
+				mask |= maskOf(i);
+		}
+		return mask;
+	}
+
+	/**
+	 * Call cb with the changed subset of keys once per committed
+	 * transaction, or per setValueStr outside of one. The callback runs in
+	 * the writer's context, never twice at once for one subscriber: commits
+	 * racing with a running delivery are handed to it and delivered in
+	 * another call once cb returns.
+	 */
+	int subscribe(ConfigMask keys, ConfigCallback cb, void* arg);
+
+#ifdef ESP32
+	/**
+	 * Post the subscriber handle to queue when keys change. Changes keep
+	 * accumulating without further posts until the consumer collects them
+	 * with fetchChanges(handle). If the queue is full the changes are
+	 * dropped and the next one posts again.
+	 */
+	int subscribe(ConfigMask keys, QueueHandle_t queue);
+#endif
+
+	ConfigMask fetchChanges(int handle);
+
+	void unsubscribe(int handle);
+
 	~Config() {
 		if (m_len) {
 			delete [] m_offsets;
@@ -218,11 +304,32 @@ public:
 		  m_offsets(nullptr),
 		  m_values(nullptr),
 		  m_tr_values(nullptr),
-		  m_tr_counter(0) {}
+		  m_tr_counter(0) {
+			for (auto& sub : m_subs) {
+				sub.keys = 0;
+				sub.pending = 0;
+				sub.busy = false;
+			}
+		}
 
 		Config(Config&) = delete;
 		Config(Config&&) = delete;
 
+		struct Subscriber {
+			std::atomic<ConfigMask> keys;
+			std::atomic<ConfigMask> pending;
+			//Set while a writer runs the callback
+			std::atomic<bool> busy;
+			ConfigCallback cb;
+			void* arg;
+#ifdef ESP32
+			QueueHandle_t queue;
+#endif
+		};
+
+		int addSubscriber(ConfigMask keys, ConfigCallback cb, void* arg, void* queue);
+		void notify(ConfigMask changed);
+
 	private:
 		size_t m_len = 0;
 		size_t m_values_size;
@@ -232,6 +339,7 @@ public:
 		char* m_tr_values = NULL;
 		int m_tr_counter = 0;
 		std::mutex m_lock;
+		Subscriber m_subs[CFG_MAX_SUBSCRIBERS];
 
 };
 
@@ -258,22 +366,22 @@ template<typename T>
 T getConfig(size_t index);
 
 template<>
-const char* getConfig(size_t index) {
+inline const char* getConfig(size_t index) {
 	return impl::get(index);
 }
 
 template<>
-int getConfig(size_t index) {
+inline int getConfig(size_t index) {
 	return strtol(impl::get(index), NULL, 10);
 }
 
 template<>
-double getConfig(size_t index) {
+inline double getConfig(size_t index) {
 	return strtof(impl::get(index), NULL);
 }
 
 template<>
-bool getConfig(size_t index) {
+inline bool getConfig(size_t index) {
 	return strcmp(impl::get(index), "true") == 0 ||
 			strcmp(impl::get(index), "True") ||
 			strcmp(impl::get(index), "TRUE");
@@ -0,0 +1,200 @@
+/*
+ * dlog.cpp
+ *
+ *  Deferred logging rings and formatter, see dlog.hpp.
+ */
+
+#include "dlog.hpp"
+
+#include <stdio.h>
+
+#ifdef ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#else
+#include <sched.h>
+#include <chrono>
+#include <thread>
+#endif
+
+namespace ecuspy {
+
+namespace {
+
+DlogRing s_rings[DLOG_CORES];
+std::atomic<uint32_t> s_dropped{0};
+
+size_t currentCore() {
+#ifdef ESP32
+	return xPortGetCoreID();
+#else
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : cpu % DLOG_CORES;
+#endif
+}
+
+void printSink(const DlogRecord& r, void* arg) {
+	char buff[160];
+	int len = dlogFormat(r, buff, sizeof(buff));
+	if (len >= (int)sizeof(buff))
+		len = sizeof(buff) - 1;
+	fwrite(buff, 1, len, stdout);
+	fputc('\n', stdout);
+}
+
+}
+
+DlogRing::DlogRing() : m_head(0), m_tail(0) {
+	for (size_t i = 0; i < DLOG_RING; i++)
+		m_slots[i].seq.store(i, std::memory_order_relaxed);
+}
+
+bool DlogRing::push(const DlogRecord& r) {
+	size_t pos = m_head.load(std::memory_order_relaxed);
+	for (;;) {
+		Slot& s = m_slots[pos % DLOG_RING];
+		size_t seq = s.seq.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (!diff) {
+			if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				s.rec = r;
+				s.seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0)
+			return false;
+		else
+			pos = m_head.load(std::memory_order_relaxed);
+	}
+}
+
+bool DlogRing::pop(DlogRecord& r) {
+	Slot& s = m_slots[m_tail % DLOG_RING];
+	if (s.seq.load(std::memory_order_acquire) != m_tail + 1)
+		return false;
+	r = s.rec;
+	s.seq.store(m_tail + DLOG_RING, std::memory_order_release);
+	m_tail++;
+	return true;
+}
+
+uint32_t dlogClock() {
+#ifdef ESP32
+	return esp_timer_get_time() / 1000;
+#else
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void dlogPush(DlogRecord& r) {
+	r.ts = dlogClock();
+	if (!s_rings[currentCore()].push(r))
+		s_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t dlogDropped() {
+	return s_dropped.load(std::memory_order_relaxed);
+}
+
+int dlogFormat(const DlogRecord& r, char* buf, size_t len) {
+	static const char levels[] = "-EWID";
+	size_t pos = snprintf(buf, len, "%c (%u) ", levels[r.level < 5 ? r.level : 0], (unsigned)r.ts);
+	const char* p = r.fmt;
+	size_t arg = 0;
+
+	//Re-issue every conversion on its own with the argument at its stored type
+	while (*p && pos < len) {
+		if (*p != '%' || p[1] == '%') {
+			buf[pos++] = *p;
+			p += *p == '%' ? 2 : 1;
+			continue;
+		}
+		char spec[16];
+		size_t sl = 0;
+		int longs = 0;
+		spec[sl++] = *p++;
+		while (*p && strchr("-+ #0123456789.", *p) && sl < sizeof(spec) - 4)
+			spec[sl++] = *p++;
+		while (*p && strchr("hlzjt", *p)) {
+			longs += *p == 'l' || *p == 'z' || *p == 'j' || *p == 't';
+			p++;
+		}
+		char conv = *p ? *p++ : 0;
+		uint64_t v = arg < r.nargs ? r.args[arg++] : 0;
+		int n;
+		switch (conv) {
+		case 'd': case 'i':
+			spec[sl++] = 'l'; spec[sl++] = 'l'; spec[sl++] = conv; spec[sl] = 0;
+			n = snprintf(buf + pos, len - pos, spec, (long long)v);
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			if (!longs || (longs == 1 && sizeof(long) == 4))
+				v = (uint32_t)v;
+			spec[sl++] = 'l'; spec[sl++] = 'l'; spec[sl++] = conv; spec[sl] = 0;
+			n = snprintf(buf + pos, len - pos, spec, (unsigned long long)v);
+			break;
+		case 'c':
+			spec[sl++] = conv; spec[sl] = 0;
+			n = snprintf(buf + pos, len - pos, spec, (int)v);
+			break;
+		case 's':
+			spec[sl++] = conv; spec[sl] = 0;
+			n = snprintf(buf + pos, len - pos, spec, v ? (const char*)(uintptr_t)v : "(null)");
+			break;
+		case 'p':
+			spec[sl++] = conv; spec[sl] = 0;
+			n = snprintf(buf + pos, len - pos, spec, (void*)(uintptr_t)v);
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+			double d;
+			memcpy(&d, &v, sizeof(d));
+			spec[sl++] = conv; spec[sl] = 0;
+			n = snprintf(buf + pos, len - pos, spec, d);
+			break;
+		}
+		default:
+			n = 0;
+			break;
+		}
+		pos += n > 0 ? n : 0;
+	}
+	if (pos < len)
+		buf[pos] = 0;
+	else if (len)
+		buf[len - 1] = 0;
+	return pos;
+}
+
+size_t dlogDrain(void (*sink)(const DlogRecord& r, void* arg), void* arg) {
+	DlogRecord r;
+	size_t n = 0;
+	for (size_t c = 0; c < DLOG_CORES; c++) {
+		while (s_rings[c].pop(r)) {
+			sink(r, arg);
+			n++;
+		}
+	}
+	return n;
+}
+
+void dlogTask(void* arg) {
+	uint32_t reported = 0;
+	for (;;) {
+		if (!dlogDrain(printSink, nullptr)) {
+			uint32_t dropped = dlogDropped();
+			if (dropped != reported) {
+				printf("dlog: %u records dropped\n", (unsigned)(dropped - reported));
+				reported = dropped;
+			}
+#ifdef ESP32
+			vTaskDelay(50 / portTICK_RATE_MS);
+#else
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+#endif
+		}
+	}
+}
+
+}
@@ -0,0 +1,165 @@
+/*
+ * dlog.hpp
+ *
+ *  Deferred logging. A call site stores the format string pointer and its
+ *  raw arguments into a lock-free ring of the current core and returns;
+ *  the dlog task formats the records later at low priority.
+ *
+ *      DLOG_I("EchoWs: echo, len=%d", len);
+ *
+ *  Format strings and %s arguments have to outlive the record, use string
+ *  literals or other static storage. At most DLOG_MAX_ARGS arguments.
+ *  Levels above DLOG_LEVEL compile out, arguments are not evaluated.
+ *  When a ring is full the record is dropped and counted.
+ */
+
+#ifndef MAIN_DLOG_HPP_
+#define MAIN_DLOG_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+#define DLOG_NONE 0
+#define DLOG_ERROR 1
+#define DLOG_WARN 2
+#define DLOG_INFO 3
+#define DLOG_DEBUG 4
+
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL DLOG_INFO
+#endif
+
+namespace ecuspy {
+
+constexpr size_t DLOG_MAX_ARGS = 4;
+constexpr size_t DLOG_RING = 64;
+constexpr size_t DLOG_CORES = 2;
+
+struct DlogRecord {
+	const char* fmt;
+	uint32_t ts;
+	uint8_t level;
+	uint8_t nargs;
+	uint64_t args[DLOG_MAX_ARGS];
+};
+
+/**
+ * Bounded multi-producer ring (sequence number per slot), producers on the
+ * same core may preempt each other. Single consumer.
+ */
+class DlogRing {
+public:
+	DlogRing();
+
+	bool push(const DlogRecord& r);
+	bool pop(DlogRecord& r);
+
+private:
+	struct Slot {
+		std::atomic<size_t> seq;
+		DlogRecord rec;
+	};
+
+	Slot m_slots[DLOG_RING];
+	std::atomic<size_t> m_head;
+	size_t m_tail;
+};
+
+uint32_t dlogClock();
+void dlogPush(DlogRecord& r);
+
+/**
+ * Format a record as text, returns the length like snprintf.
+ */
+int dlogFormat(const DlogRecord& r, char* buf, size_t len);
+
+/**
+ * Hand every pending record to sink, returns the number of records.
+ */
+size_t dlogDrain(void (*sink)(const DlogRecord& r, void* arg), void* arg);
+
+/**
+ * Records dropped because a ring was full.
+ */
+uint32_t dlogDropped();
+
+/**
+ * Formatter task body, prints the records to stdout.
+ */
+void dlogTask(void* arg);
+
+namespace detail {
+
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, uint64_t>::type
+dlogArg(T v) {
+	return (uint64_t)(int64_t)v;
+}
+
+template<typename T>
+typename std::enable_if<std::is_floating_point<T>::value, uint64_t>::type
+dlogArg(T v) {
+	double d = v;
+	uint64_t u;
+	memcpy(&u, &d, sizeof(u));
+	return u;
+}
+
+template<typename T>
+uint64_t dlogArg(const T* v) {
+	return (uintptr_t)v;
+}
+
+inline void dlogStore(uint64_t*) {}
+
+template<typename T, typename... Args>
+void dlogStore(uint64_t* out, T v, Args... rest) {
+	*out = dlogArg(v);
+	dlogStore(out + 1, rest...);
+}
+
+}
+
+template<typename... Args>
+void dlogWrite(uint8_t level, const char* fmt, Args... args) {
+	static_assert(sizeof...(Args) <= DLOG_MAX_ARGS, "too many dlog arguments");
+	DlogRecord r;
+	r.fmt = fmt;
+	r.level = level;
+	r.nargs = sizeof...(Args);
+	detail::dlogStore(r.args, args...);
+	dlogPush(r);
+}
+
+}
+
+#define DLOG_AT(level, fmt, ...) ecuspy::dlogWrite(level, fmt, ##__VA_ARGS__)
+
+#if DLOG_LEVEL >= DLOG_ERROR
+#define DLOG_E(fmt, ...) DLOG_AT(DLOG_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define DLOG_E(fmt, ...) ((void)0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_WARN
+#define DLOG_W(fmt, ...) DLOG_AT(DLOG_WARN, fmt, ##__VA_ARGS__)
+#else
+#define DLOG_W(fmt, ...) ((void)0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_INFO
+#define DLOG_I(fmt, ...) DLOG_AT(DLOG_INFO, fmt, ##__VA_ARGS__)
+#else
+#define DLOG_I(fmt, ...) ((void)0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_DEBUG
+#define DLOG_D(fmt, ...) DLOG_AT(DLOG_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define DLOG_D(fmt, ...) ((void)0)
+#endif
+
+#endif /* MAIN_DLOG_HPP_ */
@@ -0,0 +1,214 @@
+/*
+ * dtc.cpp
+ *
+ *  DTC cache refresh and change detection, see dtc.hpp.
+ */
+
+#include "dtc.hpp"
+#include "obd.hpp"
+#include "clock.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+namespace ecuspy {
+
+namespace {
+
+//Freeze frame PIDs read for every ECU with a stored DTC
+const uint8_t ffPids[DTC_FF_PIDS] = {0x04, 0x05, 0x0B, 0x0C, 0x0D, 0x0F, 0x10, 0x11};
+
+}
+
+void dtcFormat(uint16_t code, char* buf) {
+	snprintf(buf, 6, "%c%u%03X", "PCBU"[code >> 14], (code >> 12) & 3, code & 0xFFF);
+}
+
+DtcCache::DtcCache() : m_version(0), m_mil_len(0), m_mil_seen(0), m_pending(true), m_mil_changed(false) {
+	memset(&m_snap, 0, sizeof(m_snap));
+}
+
+void DtcCache::snapshot(DtcSnapshot& out) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	memcpy(&out, &m_snap, sizeof(out));
+}
+
+void DtcCache::requestRefresh() {
+	std::lock_guard<std::mutex> guard{m_lock};
+	m_pending = true;
+	m_cv.notify_all();
+}
+
+//Caller holds m_lock. Returns whether the state of ecu changed.
+bool DtcCache::updateMil(uint16_t ecu, uint8_t a) {
+	size_t i = 0;
+	while (i < m_mil_len && m_mil[i].ecu != ecu)
+		i++;
+	if (i < m_mil_len && m_mil[i].a == a)
+		return false;
+	if (i == m_mil_len) {
+		if (m_mil_len == OBD_MAX_ECUS)
+			return false;
+		m_mil_len++;
+	}
+	m_mil[i] = MilState{ecu, a};
+	return true;
+}
+
+void DtcCache::milStatus(uint16_t ecu, uint8_t a) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	m_mil_seen = clockMs();
+	if (updateMil(ecu, a)) {
+		m_mil_changed = true;
+		m_cv.notify_all();
+	}
+}
+
+bool DtcCache::pollMil(ObdAdapter& adapter) {
+	ObdResponse resp[OBD_MAX_ECUS];
+	const uint8_t pid = 0x01;
+	int n = adapter.request(0x01, &pid, 1, resp, OBD_MAX_ECUS);
+	for (int i = 0; i < n; i++) {
+		if (resp[i].len >= 2 && resp[i].data[0] == pid)
+			milStatus(resp[i].ecu, resp[i].data[1]);
+	}
+	return n >= 0;
+}
+
+EcuDtcs* DtcCache::ecuOf(DtcSnapshot& snap, uint16_t ecu) {
+	for (size_t i = 0; i < snap.ecus; i++) {
+		if (snap.ecu[i].ecu == ecu)
+			return &snap.ecu[i];
+	}
+	if (snap.ecus == OBD_MAX_ECUS)
+		return nullptr;
+	snap.ecu[snap.ecus].ecu = ecu;
+	return &snap.ecu[snap.ecus++];
+}
+
+bool DtcCache::readCodes(ObdAdapter& adapter, uint8_t mode, DtcKind_t kind, DtcSnapshot& snap) {
+	ObdResponse resp[OBD_MAX_ECUS];
+	int n = adapter.request(mode, nullptr, 0, resp, OBD_MAX_ECUS);
+	for (int i = 0; i < n; i++) {
+		EcuDtcs* e = ecuOf(snap, resp[i].ecu);
+		if (!e || !resp[i].len)
+			continue;
+		size_t count = (resp[i].len - 1) / 2;
+		if (count > resp[i].data[0])
+			count = resp[i].data[0];
+		for (size_t c = 0; c < count && e->count[kind] < DTC_MAX_CODES; c++) {
+			uint16_t code = resp[i].data[1 + c * 2] << 8 | resp[i].data[2 + c * 2];
+			if (code)
+				e->codes[kind][e->count[kind]++] = code;
+		}
+	}
+	return n >= 0;
+}
+
+void DtcCache::readFrame(ObdAdapter& adapter, DtcSnapshot& snap) {
+	ObdResponse resp[OBD_MAX_ECUS];
+	uint8_t args[2] = {0x02, 0};
+	int n = adapter.request(0x02, args, 2, resp, OBD_MAX_ECUS);
+	for (int i = 0; i < n; i++) {
+		EcuDtcs* e = ecuOf(snap, resp[i].ecu);
+		if (e && resp[i].len >= 4 && resp[i].data[0] == 0x02) {
+			e->frame.dtc = resp[i].data[2] << 8 | resp[i].data[3];
+			e->has_frame = e->frame.dtc != 0;
+		}
+	}
+
+	for (size_t p = 0; p < DTC_FF_PIDS; p++) {
+		const PidInfo* info = pidInfo(ffPids[p]);
+		args[0] = ffPids[p];
+		n = adapter.request(0x02, args, 2, resp, OBD_MAX_ECUS);
+		for (int i = 0; i < n; i++) {
+			EcuDtcs* e = ecuOf(snap, resp[i].ecu);
+			if (!e || !e->has_frame || resp[i].len < 2 + info->bytes || resp[i].data[0] != args[0])
+				continue;
+			FreezeFrame& f = e->frame;
+			//An ECU answering twice must not push the frame past its PIDs
+			if (f.pids >= DTC_FF_PIDS)
+				continue;
+			f.pid[f.pids] = args[0];
+			f.value[f.pids++] = pidDecode(*info, resp[i].data + 2);
+		}
+	}
+}
+
+bool DtcCache::refresh(ObdAdapter& adapter) {
+	DtcSnapshot snap;
+	ObdResponse resp[OBD_MAX_ECUS];
+	memset(&snap, 0, sizeof(snap));
+
+	const uint8_t pid = 0x01;
+	int n = adapter.request(0x01, &pid, 1, resp, OBD_MAX_ECUS);
+	if (n < 0)
+		return false;
+	MilState mil[OBD_MAX_ECUS];
+	size_t mils = 0;
+	for (int i = 0; i < n; i++) {
+		EcuDtcs* e = ecuOf(snap, resp[i].ecu);
+		if (e && resp[i].len >= 2 && resp[i].data[0] == pid) {
+			e->mil = resp[i].data[1] & 0x80;
+			mil[mils++] = MilState{resp[i].ecu, resp[i].data[1]};
+		}
+	}
+	if (!readCodes(adapter, 0x03, dtcStored, snap) || !readCodes(adapter, 0x07, dtcPending, snap) ||
+			!readCodes(adapter, 0x0A, dtcPermanent, snap))
+		return false;
+	bool stored = false;
+	for (size_t i = 0; i < snap.ecus; i++)
+		stored |= snap.ecu[i].count[dtcStored] != 0;
+	if (stored)
+		readFrame(adapter, snap);
+	snap.ts = clockMs();
+
+	//Only a change of content moves the version, the read time always updates
+	std::lock_guard<std::mutex> guard{m_lock};
+	bool same = true;
+	for (size_t i = 0; i < mils; i++)
+		same &= !updateMil(mil[i].ecu, mil[i].a);
+	//A report that arrived during the refresh and matches what it read is covered by it
+	if (same)
+		m_mil_changed = false;
+	if (snap.ecus != m_snap.ecus || memcmp(snap.ecu, m_snap.ecu, sizeof(snap.ecu))) {
+		snap.version = m_version.load() + 1;
+		memcpy(&m_snap, &snap, sizeof(snap));
+		m_version.store(snap.version);
+	} else
+		m_snap.ts = snap.ts;
+	return true;
+}
+
+void DtcCache::run(ObdAdapter& adapter) {
+	for (;;) {
+		bool pending, poll;
+		{
+			std::unique_lock<std::mutex> lock{m_lock};
+			m_cv.wait_for(lock, std::chrono::milliseconds(DTC_MIL_POLL_MS),
+					[this] {return m_pending || m_mil_changed;});
+			pending = m_pending || m_mil_changed;
+			poll = !pending && clockMs() - m_mil_seen >= DTC_MIL_POLL_MS;
+		}
+		if (poll && !pollMil(adapter))
+			continue;
+
+		{
+			std::lock_guard<std::mutex> guard{m_lock};
+			pending = m_pending || m_mil_changed;
+			m_pending = m_mil_changed = false;
+		}
+		if (pending && !refresh(adapter)) {
+			//Forget the MIL states, the next poll schedules the retry
+			std::lock_guard<std::mutex> guard{m_lock};
+			m_mil_len = 0;
+		}
+	}
+}
+
+void dtcTask(void* arg) {
+	DtcCache::instance().run(*static_cast<ObdAdapter*>(arg));
+}
+
+}
@@ -0,0 +1,130 @@
+/*
+ * dtc.hpp
+ *
+ *  Diagnostic trouble code cache. A low-priority task reads stored (03),
+ *  pending (07) and permanent (0A) DTCs plus freeze frame 0 (02) of every
+ *  ECU, but only when the MIL status (01 01) changed or a refresh was
+ *  asked for. Readers get a copy of the cache and a version counter that
+ *  only moves when the content changed, so serving the UI costs no bus
+ *  traffic.
+ */
+
+#ifndef MAIN_DTC_HPP_
+#define MAIN_DTC_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "templates.hpp"
+#include "adapter.hpp"
+
+namespace ecuspy {
+
+constexpr size_t DTC_MAX_CODES = 16;
+constexpr size_t DTC_FF_PIDS = 8;
+constexpr uint32_t DTC_MIL_POLL_MS = 30000;
+
+enum DtcKind_t {
+	dtcStored,
+	dtcPending,
+	dtcPermanent,
+	dtcKinds
+};
+
+struct FreezeFrame {
+	uint16_t dtc;
+	uint8_t pids;
+	uint8_t pid[DTC_FF_PIDS];
+	float value[DTC_FF_PIDS];
+};
+
+struct EcuDtcs {
+	uint16_t ecu;
+	bool mil;
+	bool has_frame;
+	uint8_t count[dtcKinds];
+	uint16_t codes[dtcKinds][DTC_MAX_CODES];
+	FreezeFrame frame;
+};
+
+struct DtcSnapshot {
+	uint32_t version;
+	/**
+	 * clockMs() of the last read from the bus.
+	 */
+	uint32_t ts;
+	size_t ecus;
+	EcuDtcs ecu[OBD_MAX_ECUS];
+};
+
+/**
+ * "P0123" style text of a DTC, buf holds at least 6 bytes.
+ */
+void dtcFormat(uint16_t code, char* buf);
+
+class DtcCache : public tpl::Singleton<DtcCache> {
+public:
+	/**
+	 * Background refresher, never returns. Polls the MIL status itself
+	 * when nobody reported it for DTC_MIL_POLL_MS.
+	 */
+	void run(ObdAdapter& adapter);
+
+	/**
+	 * Mode 01 PID 01 byte A as seen by acquisition. A change of the MIL or
+	 * the DTC count schedules a refresh.
+	 */
+	void milStatus(uint16_t ecu, uint8_t a);
+
+	void requestRefresh();
+
+	/**
+	 * Read everything from the bus now. Returns false on adapter errors,
+	 * the cache then keeps its previous content.
+	 */
+	bool refresh(ObdAdapter& adapter);
+
+	uint32_t version() const {
+		return m_version.load();
+	}
+
+	void snapshot(DtcSnapshot& out);
+
+private:
+	friend class Singleton<DtcCache>;
+
+	DtcCache();
+
+	struct MilState {
+		uint16_t ecu;
+		uint8_t a;
+	};
+
+	bool updateMil(uint16_t ecu, uint8_t a);
+	bool pollMil(ObdAdapter& adapter);
+	bool readCodes(ObdAdapter& adapter, uint8_t mode, DtcKind_t kind, DtcSnapshot& snap);
+	void readFrame(ObdAdapter& adapter, DtcSnapshot& snap);
+	static EcuDtcs* ecuOf(DtcSnapshot& snap, uint16_t ecu);
+
+	DtcSnapshot m_snap;
+	std::atomic<uint32_t> m_version;
+	MilState m_mil[OBD_MAX_ECUS];
+	size_t m_mil_len;
+	uint32_t m_mil_seen;
+	bool m_pending;
+	bool m_mil_changed;
+	std::mutex m_lock;
+	std::condition_variable m_cv;
+};
+
+/**
+ * Task body for the Topology table, arg is the ObdAdapter.
+ */
+void dtcTask(void* arg);
+
+}
+
+#endif /* MAIN_DTC_HPP_ */
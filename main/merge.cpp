@@ -0,0 +1,94 @@
+/*
+ * merge.cpp
+ *
+ *  Watermark based k-way merge of the session sample streams, see merge.hpp.
+ */
+
+#include "merge.hpp"
+#include "clock.hpp"
+
+#include <string.h>
+
+namespace ecuspy {
+
+SampleMerger::SampleMerger() : m_last(0), m_emitted(false), m_late(0), m_sink(nullptr), m_arg(nullptr) {
+	memset(m_sources, 0, sizeof(m_sources));
+}
+
+void SampleMerger::setSink(SampleSink sink, void* arg) {
+	std::lock_guard<std::mutex> guard{m_emit};
+	m_sink = sink;
+	m_arg = arg;
+}
+
+//Caller holds m_lock
+bool SampleMerger::popReady(Sample& out) {
+	Source* oldest = nullptr;
+	bool full = false;
+	for (Source& s : m_sources) {
+		if (!s.len)
+			continue;
+		full |= s.len == MERGE_DEPTH;
+		if (!oldest || s.ring[s.head].ts < oldest->ring[oldest->head].ts)
+			oldest = &s;
+	}
+	if (!oldest)
+		return false;
+
+	uint32_t ts = oldest->ring[oldest->head].ts;
+	if (!full) {
+		//Every live source has to be past ts, lagging ones are ignored
+		uint32_t now = clockMs();
+		for (Source& s : m_sources) {
+			if (s.active && &s != oldest && (int32_t)(s.watermark - ts) < 0 &&
+					(int32_t)(now - s.watermark) <= (int32_t)MERGE_MAX_LAG_MS)
+				return false;
+		}
+	}
+	out = oldest->ring[oldest->head];
+	oldest->head = (oldest->head + 1) % MERGE_DEPTH;
+	oldest->len--;
+	m_last = ts;
+	m_emitted = true;
+	return true;
+}
+
+void SampleMerger::push(uint8_t source, const Sample* samples, size_t len, uint32_t watermark) {
+	if (source >= MERGE_MAX_SOURCES)
+		return;
+	for (size_t i = 0;; ) {
+		{
+			std::lock_guard<std::mutex> guard{m_lock};
+			Source& s = m_sources[source];
+			s.active = true;
+			for (; i < len && s.len < MERGE_DEPTH; i++) {
+				if (m_emitted && (int32_t)(samples[i].ts - m_last) < 0) {
+					m_late++;
+					continue;
+				}
+				s.ring[(s.head + s.len++) % MERGE_DEPTH] = samples[i];
+			}
+			if (i == len && (int32_t)(watermark - s.watermark) > 0)
+				s.watermark = watermark;
+		}
+
+		//Emit outside m_lock, so pushes of other sources are not held up by the sink
+		{
+			std::lock_guard<std::mutex> guard{m_emit};
+			Sample out;
+			for (;;) {
+				{
+					std::lock_guard<std::mutex> lock{m_lock};
+					if (!popReady(out))
+						break;
+				}
+				if (m_sink)
+					m_sink(out, m_arg);
+			}
+		}
+		if (i == len)
+			break;
+	}
+}
+
+}
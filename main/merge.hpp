@@ -0,0 +1,84 @@
+/*
+ * merge.hpp
+ *
+ *  Time-ordered merge of the sample streams of several adapter sessions.
+ *  Every source stamps against the same clock and is monotonic on its own;
+ *  besides samples it reports a watermark, the time before which it will
+ *  not produce anything anymore. A sample goes out once it is the oldest
+ *  one queued and no live source can still produce an older one, so the
+ *  output is monotonic across sources.
+ *
+ *  A source whose watermark lags more than MERGE_MAX_LAG_MS behind the
+ *  clock stops holding the others back; its samples that arrive too late
+ *  to keep the output ordered are dropped and counted. The same goes for
+ *  a source queue that fills up: its oldest sample goes out regardless.
+ */
+
+#ifndef MAIN_MERGE_HPP_
+#define MAIN_MERGE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+#include "templates.hpp"
+#include "samples.hpp"
+
+namespace ecuspy {
+
+constexpr size_t MERGE_MAX_SOURCES = 4;
+constexpr size_t MERGE_DEPTH = 32;
+constexpr uint32_t MERGE_MAX_LAG_MS = 1000;
+
+typedef void (*SampleSink)(const Sample& s, void* arg);
+
+class SampleMerger : public tpl::Singleton<SampleMerger> {
+public:
+	/**
+	 * Where merged samples go, they are dropped until it is set.
+	 */
+	void setSink(SampleSink sink, void* arg);
+
+	/**
+	 * Queue samples of one source, all stamped before watermark, and
+	 * emit whatever became ready. Samples must not be older than the
+	 * source's previous watermark.
+	 */
+	void push(uint8_t source, const Sample* samples, size_t len, uint32_t watermark);
+
+	uint32_t late() const {
+		return m_late;
+	}
+
+private:
+	friend class Singleton<SampleMerger>;
+
+	SampleMerger();
+
+	struct Source {
+		bool active;
+		uint32_t watermark;
+		uint8_t head;
+		uint8_t len;
+		Sample ring[MERGE_DEPTH];
+	};
+
+	bool popReady(Sample& out);
+
+	Source m_sources[MERGE_MAX_SOURCES];
+	uint32_t m_last;
+	bool m_emitted;
+	uint32_t m_late;
+	SampleSink m_sink;
+	void* m_arg;
+	std::mutex m_lock;
+	/**
+	 * Held while emitting, keeps the sink calls of concurrent pushes in
+	 * order.
+	 */
+	std::mutex m_emit;
+};
+
+}
+
+#endif /* MAIN_MERGE_HPP_ */
@@ -0,0 +1,48 @@
+/*
+ * obd.cpp
+ *
+ *  Mode 01 PID table.
+ */
+
+#include <string.h>
+
+#include "obd.hpp"
+#include "templates.hpp"
+
+namespace ecuspy {
+
+namespace {
+
+const PidInfo pids[] = {
+		{0x04, 1, 100.0f / 255, 0, 0, 100, "load"},
+		{0x05, 1, 1, -40, -40, 215, "coolant"},
+		{0x0B, 1, 1, 0, 0, 255, "map"},
+		{0x0C, 2, 0.25f, 0, 0, 16383.75f, "rpm"},
+		{0x0D, 1, 1, 0, 0, 255, "speed"},
+		{0x0F, 1, 1, -40, -40, 215, "iat"},
+		{0x10, 2, 0.01f, 0, 0, 655.35f, "maf"},
+		{0x11, 1, 100.0f / 255, 0, 0, 100, "throttle"},
+		{0x2F, 1, 100.0f / 255, 0, 0, 100, "fuel"},
+		{0x42, 2, 0.001f, 0, 0, 65.535f, "voltage"},
+		{0x46, 1, 1, -40, -40, 215, "ambient"},
+		{0x5C, 1, 1, -40, -40, 210, "oiltemp"}};
+
+}
+
+const PidInfo* pidInfo(uint8_t pid) {
+	for (size_t i = 0; i < tpl::countof(pids); i++) {
+		if (pids[i].pid == pid)
+			return &pids[i];
+	}
+	return nullptr;
+}
+
+const PidInfo* pidByName(const char* name) {
+	for (size_t i = 0; i < tpl::countof(pids); i++) {
+		if (!strcmp(pids[i].name, name))
+			return &pids[i];
+	}
+	return nullptr;
+}
+
+}
@@ -0,0 +1,40 @@
+/*
+ * obd.hpp
+ *
+ *  OBD-II mode 01 PID descriptions. Every PID handled here decodes
+ *  linearly: value = raw * scale + offset, raw being A or 256A+B.
+ */
+
+#ifndef MAIN_OBD_HPP_
+#define MAIN_OBD_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace ecuspy {
+
+struct PidInfo {
+	uint8_t pid;
+	uint8_t bytes;
+	float scale;
+	float offset;
+	float lo;
+	float hi;
+	const char* name;
+};
+
+/**
+ * Description of a mode 01 PID, nullptr for unknown ones.
+ */
+const PidInfo* pidInfo(uint8_t pid);
+
+const PidInfo* pidByName(const char* name);
+
+inline float pidDecode(const PidInfo& info, const uint8_t* data) {
+	uint32_t raw = info.bytes == 2 ? (data[0] << 8) | data[1] : data[0];
+	return raw * info.scale + info.offset;
+}
+
+}
+
+#endif /* MAIN_OBD_HPP_ */
@@ -0,0 +1,339 @@
+/*
+ * ota.cpp
+ *
+ *  Pipelined firmware update and its flash backends, see ota.hpp.
+ */
+
+#include "ota.hpp"
+
+#include <string.h>
+#include <chrono>
+
+namespace ecuspy {
+
+#ifdef ESP32
+
+Sha256::Sha256() {
+	mbedtls_sha256_init(&m_ctx);
+	mbedtls_sha256_starts(&m_ctx, 0);
+}
+
+Sha256::~Sha256() {
+	mbedtls_sha256_free(&m_ctx);
+}
+
+void Sha256::update(const uint8_t* data, size_t len) {
+	mbedtls_sha256_update(&m_ctx, data, len);
+}
+
+void Sha256::finish(uint8_t* digest) {
+	mbedtls_sha256_finish(&m_ctx, digest);
+}
+
+bool EspFlashBackend::begin(size_t size) {
+	m_part = esp_ota_get_next_update_partition(NULL);
+	if (!m_part || size > m_part->size)
+		return false;
+	m_written = 0;
+#ifdef OTA_WITH_SEQUENTIAL_WRITES
+	m_erased = m_part->size;
+	return esp_ota_begin(m_part, OTA_WITH_SEQUENTIAL_WRITES, &m_handle) == ESP_OK;
+#else
+	m_erased = SPI_FLASH_SEC_SIZE;
+	return esp_ota_begin(m_part, SPI_FLASH_SEC_SIZE, &m_handle) == ESP_OK;
+#endif
+}
+
+bool EspFlashBackend::write(const uint8_t* data, size_t len) {
+	if (m_written + len > m_part->size)
+		return false;
+	for (; m_erased < m_written + len; m_erased += SPI_FLASH_SEC_SIZE) {
+		if (esp_partition_erase_range(m_part, m_erased, SPI_FLASH_SEC_SIZE) != ESP_OK)
+			return false;
+	}
+	m_written += len;
+	return esp_ota_write(m_handle, data, len) == ESP_OK;
+}
+
+bool EspFlashBackend::finish() {
+	//Checks the image header, segments and the appended checksum/hash
+	esp_ota_handle_t handle = m_handle;
+	m_handle = 0;
+	return esp_ota_end(handle) == ESP_OK;
+}
+
+bool EspFlashBackend::activate() {
+	return esp_ota_set_boot_partition(m_part) == ESP_OK;
+}
+
+void EspFlashBackend::abort() {
+	//esp_ota_end releases the handle, the partition stays unbootable
+	if (m_handle)
+		esp_ota_end(m_handle);
+	m_handle = 0;
+}
+
+FlashBackend& otaFlash() {
+	static EspFlashBackend flash;
+	return flash;
+}
+
+#else
+
+namespace {
+
+const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+inline uint32_t ror(uint32_t x, int n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+}
+
+Sha256::Sha256() : m_len(0) {
+	static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+			0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	memcpy(m_state, init, sizeof(m_state));
+}
+
+Sha256::~Sha256() {}
+
+void Sha256::block(const uint8_t* p) {
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t)p[i * 4] << 24 | p[i * 4 + 1] << 16 | p[i * 4 + 2] << 8 | p[i * 4 + 3];
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+	uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+	m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+}
+
+void Sha256::update(const uint8_t* data, size_t len) {
+	size_t fill = m_len % 64;
+	m_len += len;
+	if (fill) {
+		size_t n = len < 64 - fill ? len : 64 - fill;
+		memcpy(m_buf + fill, data, n);
+		data += n;
+		len -= n;
+		if (fill + n < 64)
+			return;
+		block(m_buf);
+	}
+	for (; len >= 64; data += 64, len -= 64)
+		block(data);
+	memcpy(m_buf, data, len);
+}
+
+void Sha256::finish(uint8_t* digest) {
+	uint64_t bits = m_len * 8;
+	uint8_t pad[72] = {0x80};
+	size_t padLen = (m_len % 64 < 56 ? 56 : 120) - m_len % 64;
+	for (int i = 0; i < 8; i++)
+		pad[padLen + i] = bits >> (56 - i * 8);
+	update(pad, padLen + 8);
+	for (int i = 0; i < 8; i++) {
+		digest[i * 4] = m_state[i] >> 24;
+		digest[i * 4 + 1] = m_state[i] >> 16;
+		digest[i * 4 + 2] = m_state[i] >> 8;
+		digest[i * 4 + 3] = m_state[i];
+	}
+}
+
+bool FileFlashBackend::begin(size_t size) {
+	char tmp[256];
+	snprintf(tmp, sizeof(tmp), "%s.new", m_path);
+	m_file = fopen(tmp, "wb");
+	return m_file != nullptr;
+}
+
+bool FileFlashBackend::write(const uint8_t* data, size_t len) {
+	return fwrite(data, 1, len, m_file) == len;
+}
+
+bool FileFlashBackend::finish() {
+	bool ok = !fflush(m_file) && !ferror(m_file);
+	fclose(m_file);
+	m_file = nullptr;
+	return ok;
+}
+
+bool FileFlashBackend::activate() {
+	char tmp[256];
+	snprintf(tmp, sizeof(tmp), "%s.new", m_path);
+	return !rename(tmp, m_path);
+}
+
+void FileFlashBackend::abort() {
+	if (m_file)
+		fclose(m_file);
+	m_file = nullptr;
+}
+
+FlashBackend& otaFlash() {
+	static FileFlashBackend flash("ota.bin");
+	return flash;
+}
+
+#endif
+
+namespace {
+
+//Flash writes stall both cores, the writer only has to keep up with the network
+const TaskSpec otaWriterSpec = {"otawrite", nullptr, nullptr, 1, 4, 3072};
+
+}
+
+const char* otaStatusStr(OtaStatus_t status) {
+	switch (status) {
+	case otaOk: return "ok";
+	case otaBusy: return "update in progress";
+	case otaBeginFailed: return "can't start update";
+	case otaWriteFailed: return "flash write failed";
+	case otaBadSize: return "size mismatch";
+	case otaBadImage: return "image rejected";
+	case otaBadDigest: return "SHA-256 mismatch";
+	case otaActivateFailed: return "can't set boot partition";
+	}
+	return "?";
+}
+
+OtaUpdater::OtaUpdater(FlashBackend& flash) : m_flash(flash), m_cur(0), m_fill(0), m_size(0),
+		m_received(0), m_stall_us(0), m_pending_len(0), m_stop(false), m_failed(false) {
+	memset(m_expected, 0, sizeof(m_expected));
+}
+
+OtaUpdater::~OtaUpdater() {
+	if (m_thread.joinable()) {
+		stop();
+		m_flash.abort();
+	}
+}
+
+OtaStatus_t OtaUpdater::begin(size_t size, const uint8_t* digest) {
+	if (m_thread.joinable())
+		return otaBusy;
+	if (!m_flash.begin(size))
+		return otaBeginFailed;
+	memcpy(m_expected, digest, OTA_DIGEST_LEN);
+	m_size = size;
+	TaskSpec spec = otaWriterSpec;
+	spec.fn = writerTask;
+	spec.arg = this;
+	if (!m_thread.start(spec)) {
+		m_flash.abort();
+		return otaBeginFailed;
+	}
+	return otaOk;
+}
+
+OtaStatus_t OtaUpdater::feed(const uint8_t* data, size_t len) {
+	if (m_received + len > m_size)
+		return otaBadSize;
+	m_sha.update(data, len);
+	m_received += len;
+	while (len) {
+		size_t n = len < OTA_BUF - m_fill ? len : OTA_BUF - m_fill;
+		memcpy(m_buf[m_cur] + m_fill, data, n);
+		m_fill += n;
+		data += n;
+		len -= n;
+		if (m_fill == OTA_BUF) {
+			OtaStatus_t rc = submit();
+			if (rc != otaOk)
+				return rc;
+		}
+	}
+	return otaOk;
+}
+
+//Hand the current buffer to the writer once it is done with the other one
+OtaStatus_t OtaUpdater::submit() {
+	std::unique_lock<std::mutex> lock{m_lock};
+	if (m_pending_len) {
+		auto t = std::chrono::steady_clock::now();
+		m_cv.wait(lock, [this] {return !m_pending_len;});
+		m_stall_us += std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - t).count();
+	}
+	if (m_failed)
+		return otaWriteFailed;
+	m_pending = m_cur;
+	m_pending_len = m_fill;
+	m_cv.notify_all();
+	m_cur ^= 1;
+	m_fill = 0;
+	return otaOk;
+}
+
+void OtaUpdater::writerTask(void* arg) {
+	static_cast<OtaUpdater*>(arg)->writer();
+}
+
+void OtaUpdater::writer() {
+	std::unique_lock<std::mutex> lock{m_lock};
+	for (;;) {
+		m_cv.wait(lock, [this] {return m_pending_len || m_stop;});
+		if (!m_pending_len)
+			return;
+		size_t idx = m_pending, len = m_pending_len;
+		lock.unlock();
+		bool ok = m_flash.write(m_buf[idx], len);
+		lock.lock();
+		m_failed |= !ok;
+		m_pending_len = 0;
+		m_cv.notify_all();
+	}
+}
+
+//Lets the writer finish the buffer in flight and joins it
+void OtaUpdater::stop() {
+	{
+		std::lock_guard<std::mutex> guard{m_lock};
+		m_stop = true;
+		m_cv.notify_all();
+	}
+	m_thread.join();
+}
+
+OtaStatus_t OtaUpdater::finish() {
+	OtaStatus_t rc = m_received == m_size ? otaOk : otaBadSize;
+	if (rc == otaOk && m_fill)
+		rc = submit();
+	stop();
+	if (rc == otaOk && m_failed)
+		rc = otaWriteFailed;
+	if (rc != otaOk) {
+		m_flash.abort();
+		return rc;
+	}
+
+	if (!m_flash.finish())
+		return otaBadImage;
+	uint8_t digest[OTA_DIGEST_LEN];
+	m_sha.finish(digest);
+	if (memcmp(digest, m_expected, sizeof(digest)))
+		return otaBadDigest;
+	return m_flash.activate() ? otaOk : otaActivateFailed;
+}
+
+}
@@ -0,0 +1,189 @@
+/*
+ * ota.hpp
+ *
+ *  Streaming firmware update. Incoming data is hashed as it arrives and
+ *  collected into one of two buffers; a full buffer goes to a writer task
+ *  while the other one fills, so flash erase/write overlaps the network
+ *  receive. Flash is erased a sector at a time by the writer just ahead of
+ *  the data, not up front. The image is only made bootable once the flash
+ *  backend accepted it and its SHA-256 matches the expected digest.
+ */
+
+#ifndef MAIN_OTA_HPP_
+#define MAIN_OTA_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef ESP32
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "mbedtls/sha256.h"
+#endif
+
+#include "tasks.hpp"
+
+namespace ecuspy {
+
+constexpr size_t OTA_BUF = 4096;
+constexpr size_t OTA_DIGEST_LEN = 32;
+
+class Sha256 {
+public:
+	Sha256();
+	~Sha256();
+
+	void update(const uint8_t* data, size_t len);
+	void finish(uint8_t* digest);
+
+private:
+#ifdef ESP32
+	mbedtls_sha256_context m_ctx;
+#else
+	void block(const uint8_t* p);
+
+	uint32_t m_state[8];
+	uint64_t m_len;
+	uint8_t m_buf[64];
+#endif
+};
+
+/**
+ * Where the image goes. begin() is called before the first write(),
+ * finish() after the last one; activate() makes the image bootable.
+ * write() runs on the writer task, the others on the caller's.
+ */
+class FlashBackend {
+public:
+	virtual ~FlashBackend() {}
+
+	virtual bool begin(size_t size) = 0;
+	virtual bool write(const uint8_t* data, size_t len) = 0;
+	virtual bool finish() = 0;
+	virtual bool activate() = 0;
+	virtual void abort() = 0;
+};
+
+#ifdef ESP32
+/**
+ * The next OTA app partition. begin() has to return quickly, it runs in
+ * the httpd task: with OTA_WITH_SEQUENTIAL_WRITES esp_ota_write erases as
+ * it goes, older IDFs are given one sector to erase up front and write()
+ * erases the rest.
+ */
+class EspFlashBackend : public FlashBackend {
+public:
+	EspFlashBackend() : m_part(nullptr), m_handle(0), m_written(0), m_erased(0) {}
+
+	bool begin(size_t size) override;
+	bool write(const uint8_t* data, size_t len) override;
+	bool finish() override;
+	bool activate() override;
+	void abort() override;
+
+private:
+	const esp_partition_t* m_part;
+	esp_ota_handle_t m_handle;
+	size_t m_written;
+	size_t m_erased;
+};
+#else
+/**
+ * Host shim: the image is written to <path>.new and renamed to <path> on
+ * activate().
+ */
+class FileFlashBackend : public FlashBackend {
+public:
+	explicit FileFlashBackend(const char* path) : m_path(path), m_file(nullptr) {}
+
+	bool begin(size_t size) override;
+	bool write(const uint8_t* data, size_t len) override;
+	bool finish() override;
+	bool activate() override;
+	void abort() override;
+
+private:
+	const char* m_path;
+	FILE* m_file;
+};
+#endif
+
+/**
+ * The platform's update target.
+ */
+FlashBackend& otaFlash();
+
+enum OtaStatus_t {
+	otaOk,
+	otaBusy,
+	otaBeginFailed,
+	otaWriteFailed,
+	otaBadSize,
+	otaBadImage,
+	otaBadDigest,
+	otaActivateFailed
+};
+
+const char* otaStatusStr(OtaStatus_t status);
+
+class OtaUpdater {
+public:
+	explicit OtaUpdater(FlashBackend& flash);
+	~OtaUpdater();
+
+	/**
+	 * Start an update of size bytes, digest is the expected SHA-256.
+	 */
+	OtaStatus_t begin(size_t size, const uint8_t* digest);
+	OtaStatus_t feed(const uint8_t* data, size_t len);
+
+	/**
+	 * Flush, verify and activate. The updater is done afterwards,
+	 * whatever the result.
+	 */
+	OtaStatus_t finish();
+
+	size_t received() const {
+		return m_received;
+	}
+
+	/**
+	 * Time feed() spent waiting for the writer, i.e. flash being slower
+	 * than the network.
+	 */
+	uint64_t stallUs() const {
+		return m_stall_us;
+	}
+
+private:
+	OtaStatus_t submit();
+	static void writerTask(void* arg);
+	void writer();
+	void stop();
+
+	FlashBackend& m_flash;
+	Sha256 m_sha;
+	uint8_t m_expected[OTA_DIGEST_LEN];
+	uint8_t m_buf[2][OTA_BUF];
+	size_t m_cur;
+	size_t m_fill;
+	size_t m_size;
+	size_t m_received;
+	uint64_t m_stall_us;
+
+	TaskThread m_thread;
+	std::mutex m_lock;
+	std::condition_variable m_cv;
+	size_t m_pending;
+	size_t m_pending_len;
+	bool m_stop;
+	bool m_failed;
+};
+
+}
+
+#endif /* MAIN_OTA_HPP_ */
@@ -0,0 +1,251 @@
+/*
+ * query.cpp
+ *
+ *  Streaming downsampling of the sample log, see query.hpp.
+ */
+
+#include "query.hpp"
+
+#include <math.h>
+
+namespace ecuspy {
+
+namespace {
+
+//The range is narrowed to what the log holds, so the buckets span actual data
+uint32_t logFrom(uint32_t from) {
+	uint32_t oldest, newest;
+	return SampleLog::instance().timeRange(oldest, newest) && from < oldest ? oldest : from;
+}
+
+uint32_t logTo(uint32_t to) {
+	uint32_t oldest, newest;
+	return SampleLog::instance().timeRange(oldest, newest) && to > newest ? newest + 1 : to;
+}
+
+}
+
+//Drops the vertices q makes concave, when full q takes the newest one's place
+void SeriesQuery::Chain::add(const Point& q, bool upper) {
+	while (len >= 2) {
+		const Point& o = p[len - 2];
+		const Point& a = p[len - 1];
+		double cross = ((double)a.ts - o.ts) * ((double)q.value - o.value) -
+				((double)a.value - o.value) * ((double)q.ts - o.ts);
+		if (upper ? cross < 0 : cross > 0)
+			break;
+		len--;
+	}
+	if (len == QUERY_HULL)
+		len--;
+	p[len++] = q;
+}
+
+void SeriesQuery::Bucket::reset(uint32_t i) {
+	valid = true;
+	index = i;
+	count = 0;
+	sum_ts = sum_value = 0;
+	upper.len = lower.len = 0;
+}
+
+void SeriesQuery::Bucket::add(const Point& p) {
+	if (!count)
+		min = max = p;
+	if (p.value < min.value)
+		min = p;
+	if (p.value > max.value)
+		max = p;
+	upper.add(p, true);
+	lower.add(p, false);
+	sum_ts += p.ts;
+	sum_value += p.value;
+	count++;
+}
+
+SeriesQuery::SeriesQuery(QueryMode_t mode, uint32_t from, uint32_t to, const uint8_t* pids, size_t len,
+		size_t points) : m_mode(mode), m_from(from), m_span(to > from ? to - from : 1) {
+	points = points < 3 ? 3 : points > QUERY_MAX_POINTS ? QUERY_MAX_POINTS : points;
+	//First and last point come on top of the LTTB buckets, min/max sends two per bucket
+	m_buckets = mode == queryMinMax ? points / 2 : points - 2;
+	m_len = len < QUERY_MAX_PIDS ? len : QUERY_MAX_PIDS;
+	for (size_t i = 0; i < m_len; i++) {
+		Series& s = m_series[i];
+		s.pid = pids[i];
+		s.started = false;
+		s.prev.valid = s.cur.valid = false;
+	}
+}
+
+uint32_t SeriesQuery::bucket(uint32_t ts) const {
+	uint64_t b = (uint64_t)(ts - m_from) * m_buckets / m_span;
+	return b < m_buckets ? b : m_buckets - 1;
+}
+
+//Hull vertex of b spanning the largest triangle with a and c
+SeriesQuery::Point SeriesQuery::select(const Bucket& b, const Point& a, const Point& c) const {
+	const Point* best = &b.upper.p[0];
+	double best_area = -1;
+	double cx = (double)c.ts - a.ts, cy = (double)c.value - a.value;
+	for (const Chain* chain : {&b.upper, &b.lower}) {
+		for (size_t i = 0; i < chain->len; i++) {
+			const Point& p = chain->p[i];
+			double area = fabs(cx * ((double)p.value - a.value) - ((double)p.ts - a.ts) * cy);
+			if (area > best_area) {
+				best_area = area;
+				best = &p;
+			}
+		}
+	}
+	return *best;
+}
+
+size_t SeriesQuery::feedLttb(Series& s, const Point& p, QueryPoint* out) {
+	size_t n = 0;
+	if (!s.started) {
+		s.started = true;
+		s.a = s.last = p;
+		out[n++] = QueryPoint{s.pid, p.ts, p.value};
+		return n;
+	}
+	uint32_t b = bucket(p.ts);
+	if (!s.cur.valid) {
+		s.cur.reset(b);
+	} else if (b != s.cur.index) {
+		//cur is complete, its average is the third vertex for prev
+		if (s.prev.valid) {
+			Point c{(uint32_t)(s.cur.sum_ts / s.cur.count), (float)(s.cur.sum_value / s.cur.count)};
+			s.a = select(s.prev, s.a, c);
+			out[n++] = QueryPoint{s.pid, s.a.ts, s.a.value};
+		}
+		s.prev = s.cur;
+		s.cur.reset(b);
+	}
+	s.cur.add(p);
+	s.last = p;
+	return n;
+}
+
+size_t SeriesQuery::emitMinMax(const Series& s, QueryPoint* out) {
+	const Point& lo = s.cur.min.ts <= s.cur.max.ts ? s.cur.min : s.cur.max;
+	const Point& hi = s.cur.min.ts <= s.cur.max.ts ? s.cur.max : s.cur.min;
+	out[0] = QueryPoint{s.pid, lo.ts, lo.value};
+	if (s.cur.count == 1)
+		return 1;
+	out[1] = QueryPoint{s.pid, hi.ts, hi.value};
+	return 2;
+}
+
+size_t SeriesQuery::feedMinMax(Series& s, const Point& p, QueryPoint* out) {
+	size_t n = 0;
+	uint32_t b = bucket(p.ts);
+	if (s.cur.valid && b != s.cur.index)
+		n = emitMinMax(s, out);
+	if (!s.cur.valid || b != s.cur.index)
+		s.cur.reset(b);
+	s.cur.add(p);
+	return n;
+}
+
+size_t SeriesQuery::feed(const LogRecord& r, QueryPoint* out) {
+	for (size_t i = 0; i < m_len; i++) {
+		Series& s = m_series[i];
+		if (s.pid != r.pid)
+			continue;
+		Point p{r.ts, r.value};
+		switch (m_mode) {
+		case queryLttb:
+			return feedLttb(s, p, out);
+		case queryMinMax:
+			return feedMinMax(s, p, out);
+		default:
+			out[0] = QueryPoint{r.pid, r.ts, r.value};
+			return 1;
+		}
+	}
+	return 0;
+}
+
+size_t SeriesQuery::finish(QueryPoint* out) {
+	size_t n = 0;
+	for (size_t i = 0; i < m_len; i++) {
+		Series& s = m_series[i];
+		if (m_mode == queryMinMax && s.cur.valid) {
+			n += emitMinMax(s, out + n);
+		} else if (m_mode == queryLttb && s.cur.valid) {
+			if (s.prev.valid) {
+				Point c{(uint32_t)(s.cur.sum_ts / s.cur.count), (float)(s.cur.sum_value / s.cur.count)};
+				s.a = select(s.prev, s.a, c);
+				out[n++] = QueryPoint{s.pid, s.a.ts, s.a.value};
+			}
+			//The last bucket is held against the last point, which always goes out
+			if (s.cur.count > 1) {
+				Point p = select(s.cur, s.a, s.last);
+				if (p.ts != s.last.ts)
+					out[n++] = QueryPoint{s.pid, p.ts, p.value};
+			}
+			out[n++] = QueryPoint{s.pid, s.last.ts, s.last.value};
+		}
+		s.prev.valid = s.cur.valid = false;
+	}
+	return n;
+}
+
+LogQuery::LogQuery(QueryMode_t mode, uint32_t from, uint32_t to, const uint8_t* pids, size_t len, size_t points) :
+		m_query(mode, logFrom(from), logTo(to), pids, len, points), m_to(to), m_records(0), m_started(false), m_sep(false),
+		m_scanned(false), m_done(false) {
+	m_seq = SampleLog::instance().lowerBound(from);
+}
+
+size_t LogQuery::put(char* buf, const QueryPoint* points, size_t n) {
+	size_t l = 0;
+	for (size_t i = 0; i < n; i++) {
+		l += sprintf(buf + l, "%s[%u,%u,%g]", m_sep ? "," : "", points[i].pid, (unsigned)points[i].ts,
+				points[i].value);
+		m_sep = true;
+	}
+	return l;
+}
+
+size_t LogQuery::next(char* buf, size_t len) {
+	LogRecord recs[QUERY_READ];
+	QueryPoint points[QUERY_MAX_PIDS * QUERY_MAX_FINISH];
+	size_t l = 0;
+
+	if (m_done)
+		return 0;
+	if (!m_started) {
+		l += sprintf(buf, "{\"points\":[");
+		m_started = true;
+	}
+	for (size_t scanned = 0; !m_scanned && scanned < QUERY_SCAN; ) {
+		size_t n = SampleLog::instance().read(m_seq, recs, QUERY_READ);
+		if (!n) {
+			m_scanned = true;
+			break;
+		}
+		size_t i;
+		for (i = 0; i < n && len - l >= QUERY_MAX_EMIT * QUERY_POINT_LEN; i++) {
+			if (recs[i].ts >= m_to) {
+				m_scanned = true;
+				break;
+			}
+			l += put(buf + l, points, m_query.feed(recs[i], points));
+		}
+		m_records += i;
+		scanned += i;
+		if (i < n && !m_scanned) {
+			//Out of room, the rest of the batch is read again next time
+			m_seq -= n - i;
+			return l;
+		}
+	}
+	if (m_scanned && len - l >= QUERY_CHUNK) {
+		l += put(buf + l, points, m_query.finish(points));
+		l += sprintf(buf + l, "]}");
+		m_done = true;
+	}
+	return l;
+}
+
+}
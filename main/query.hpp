@@ -0,0 +1,175 @@
+/*
+ * query.hpp
+ *
+ *  Chart queries over the sample log: the points of a time range for a
+ *  set of PIDs, downsampled to a target count per PID in a single pass.
+ *
+ *  queryLttb is Largest-Triangle-Three-Buckets over time buckets. Plain
+ *  LTTB keeps every point of a bucket until the next bucket's average is
+ *  known. The triangle area is linear in the candidate point though, so
+ *  the best point is a vertex of the bucket's convex hull, and as points
+ *  come in time order the hull is built as they arrive (monotone chain).
+ *  A bucket keeps just that, up to QUERY_HULL vertices per side; the
+ *  choice is LTTB's unless a hull side overflows, which replaces its
+ *  newest vertex. queryMinMax sends the lowest and the highest point of
+ *  every bucket, queryRaw everything.
+ *
+ *  Memory is bounded by QUERY_MAX_PIDS, about 4 KB, whatever the range.
+ *  The points of one PID come out in time order; PIDs are interleaved.
+ */
+
+#ifndef MAIN_QUERY_HPP_
+#define MAIN_QUERY_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "samplelog.hpp"
+
+namespace ecuspy {
+
+constexpr size_t QUERY_MAX_PIDS = 8;
+constexpr size_t QUERY_MAX_POINTS = 4000;
+constexpr size_t QUERY_HULL = 12;
+/**
+ * Most points one feed() call produces, and finish() per PID.
+ */
+constexpr size_t QUERY_MAX_EMIT = 2;
+constexpr size_t QUERY_MAX_FINISH = 3;
+constexpr size_t QUERY_READ = 32;
+/**
+ * Records one LogQuery::next() call scans at most, bounds the time a
+ * sparse query holds the httpd task.
+ */
+constexpr size_t QUERY_SCAN = 4096;
+/**
+ * Longest formatted point including the separator, and the smallest
+ * buffer LogQuery::next() works with.
+ */
+constexpr size_t QUERY_POINT_LEN = 34;
+constexpr size_t QUERY_CHUNK = QUERY_MAX_PIDS * QUERY_MAX_FINISH * QUERY_POINT_LEN + 16;
+
+enum QueryMode_t {
+	queryRaw,
+	queryLttb,
+	queryMinMax
+};
+
+struct QueryPoint {
+	uint8_t pid;
+	uint32_t ts;
+	float value;
+};
+
+/**
+ * The downsampler, fed the log records of [from, to) in time order.
+ */
+class SeriesQuery {
+public:
+	/**
+	 * points is per PID, at least 3.
+	 */
+	SeriesQuery(QueryMode_t mode, uint32_t from, uint32_t to, const uint8_t* pids, size_t len, size_t points);
+
+	/**
+	 * Returns the number of points put into out, at most QUERY_MAX_EMIT.
+	 */
+	size_t feed(const LogRecord& r, QueryPoint* out);
+
+	/**
+	 * The remaining points, at most QUERY_MAX_FINISH per PID.
+	 */
+	size_t finish(QueryPoint* out);
+
+private:
+	struct Point {
+		uint32_t ts;
+		float value;
+	};
+
+	/**
+	 * Upper or lower side of a convex hull, left to right.
+	 */
+	struct Chain {
+		uint8_t len;
+		Point p[QUERY_HULL];
+
+		void add(const Point& q, bool upper);
+	};
+
+	struct Bucket {
+		bool valid;
+		uint32_t index;
+		uint32_t count;
+		double sum_ts;
+		double sum_value;
+		Point min;
+		Point max;
+		Chain upper;
+		Chain lower;
+
+		void reset(uint32_t i);
+		void add(const Point& p);
+	};
+
+	struct Series {
+		uint8_t pid;
+		bool started;
+		Point a;
+		Point last;
+		Bucket prev;
+		Bucket cur;
+	};
+
+	uint32_t bucket(uint32_t ts) const;
+	Point select(const Bucket& b, const Point& a, const Point& c) const;
+	size_t feedLttb(Series& s, const Point& p, QueryPoint* out);
+	size_t feedMinMax(Series& s, const Point& p, QueryPoint* out);
+	size_t emitMinMax(const Series& s, QueryPoint* out);
+
+	QueryMode_t m_mode;
+	uint32_t m_from;
+	uint32_t m_span;
+	uint32_t m_buckets;
+	Series m_series[QUERY_MAX_PIDS];
+	size_t m_len;
+};
+
+/**
+ * A query run against the SampleLog, producing the JSON body
+ * {"points":[[pid,ts,value],...]} a chunk at a time.
+ */
+class LogQuery {
+public:
+	LogQuery(QueryMode_t mode, uint32_t from, uint32_t to, const uint8_t* pids, size_t len, size_t points);
+
+	/**
+	 * Fill buf with the next part of the body, len is at least QUERY_CHUNK.
+	 * Returns the bytes written, which may be none while scanning.
+	 */
+	size_t next(char* buf, size_t len);
+
+	bool done() const {
+		return m_done;
+	}
+
+	uint32_t records() const {
+		return m_records;
+	}
+
+private:
+	size_t put(char* buf, const QueryPoint* points, size_t n);
+
+	SeriesQuery m_query;
+	uint32_t m_to;
+	uint32_t m_seq;
+	uint32_t m_records;
+	bool m_started;
+	bool m_sep;
+	bool m_scanned;
+	bool m_done;
+};
+
+}
+
+#endif /* MAIN_QUERY_HPP_ */
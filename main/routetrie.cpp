@@ -0,0 +1,112 @@
+/*
+ * routetrie.cpp
+ *
+ *  Radix trie construction and lookup, see routetrie.hpp.
+ */
+
+#include "routetrie.hpp"
+
+#include <string.h>
+
+namespace ecuspy {
+
+constexpr uint16_t RouteTrie::NONE;
+
+void RouteTrie::clear() {
+	m_nodes.clear();
+	m_next.clear();
+	addNode("", 0);
+}
+
+uint16_t RouteTrie::addNode(const char* label, uint16_t len) {
+	m_nodes.push_back(Node{label, len, NONE, NONE, NONE, NONE});
+	return m_nodes.size() - 1;
+}
+
+uint16_t RouteTrie::findChild(uint16_t node, char c) const {
+	uint16_t n = m_nodes[node].child;
+	while (n != NONE && m_nodes[n].label[0] != c)
+		n = m_nodes[n].sibling;
+	return n;
+}
+
+void RouteTrie::append(uint16_t& head, uint16_t index) {
+	if (m_next.size() <= index)
+		m_next.resize(index + 1, NONE);
+	uint16_t* p = &head;
+	while (*p != NONE)
+		p = &m_next[*p];
+	*p = index;
+}
+
+void RouteTrie::insert(const char* pattern, uint16_t index) {
+	size_t len = strlen(pattern);
+	bool wild = len && pattern[len - 1] == '*';
+	if (wild)
+		len--;
+
+	uint16_t node = 0;
+	const char* rest = pattern;
+	while (len) {
+		uint16_t c = findChild(node, *rest);
+		if (c == NONE) {
+			c = addNode(rest, len);
+			m_nodes[c].sibling = m_nodes[node].child;
+			m_nodes[node].child = c;
+			node = c;
+			break;
+		}
+		uint16_t p = 0;
+		while (p < m_nodes[c].len && p < len && m_nodes[c].label[p] == rest[p])
+			p++;
+		if (p < m_nodes[c].len) {
+			//Split: the tail of the label moves to a new node below c
+			uint16_t tail = addNode(m_nodes[c].label + p, m_nodes[c].len - p);
+			Node& n = m_nodes[c];
+			m_nodes[tail].child = n.child;
+			m_nodes[tail].exact = n.exact;
+			m_nodes[tail].wild = n.wild;
+			n.len = p;
+			n.child = tail;
+			n.exact = n.wild = NONE;
+		}
+		node = c;
+		rest += p;
+		len -= p;
+	}
+	append(wild ? m_nodes[node].wild : m_nodes[node].exact, index);
+}
+
+size_t RouteTrie::collect(uint16_t head, uint16_t* out, size_t n, size_t max) const {
+	//Insertion into the sorted out, when full the largest index drops out
+	for (; head != NONE; head = m_next[head], n++) {
+		size_t i = n < max ? n : max;
+		if (i == max) {
+			if (!max || out[max - 1] < head)
+				continue;
+			i--;
+		}
+		while (i && out[i - 1] > head) {
+			out[i] = out[i - 1];
+			i--;
+		}
+		out[i] = head;
+	}
+	return n;
+}
+
+size_t RouteTrie::lookup(const char* url, uint16_t* out, size_t max) const {
+	uint16_t node = 0;
+	size_t n = collect(m_nodes[0].wild, out, 0, max);
+	for (;;) {
+		if (!*url)
+			return collect(m_nodes[node].exact, out, n, max);
+		node = findChild(node, *url);
+		if (node == NONE || strncmp(m_nodes[node].label, url, m_nodes[node].len))
+			return n;
+		url += m_nodes[node].len;
+		n = collect(m_nodes[node].wild, out, n, max);
+	}
+}
+
+}
@@ -0,0 +1,73 @@
+/*
+ * routetrie.hpp
+ *
+ *  Radix trie over URL patterns with libesphttpd semantics: a pattern
+ *  matches the same URL, a pattern ending in '*' every URL starting with
+ *  what precedes the '*'. lookup() returns the indices of all matching
+ *  patterns in table order, i.e. the first one is what a top-down scan
+ *  would pick and the rest are the fallthrough candidates.
+ *
+ *  The cost of a lookup depends on the URL length and the fanout along
+ *  its path, not on the number of patterns.
+ */
+
+#ifndef MAIN_ROUTETRIE_HPP_
+#define MAIN_ROUTETRIE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace ecuspy {
+
+class RouteTrie {
+public:
+	static constexpr uint16_t NONE = 0xFFFF;
+
+	RouteTrie() {
+		clear();
+	}
+
+	void clear();
+
+	/**
+	 * Add a pattern, indices have to be added in increasing order.
+	 * The pattern has to outlive the trie.
+	 */
+	void insert(const char* pattern, uint16_t index);
+
+	/**
+	 * Matching indices in increasing order, returns how many there are.
+	 * That may exceed max, out then holds the max lowest ones.
+	 */
+	size_t lookup(const char* url, uint16_t* out, size_t max) const;
+
+	size_t nodes() const {
+		return m_nodes.size();
+	}
+
+private:
+	struct Node {
+		const char* label;
+		uint16_t len;
+		uint16_t child;
+		uint16_t sibling;
+		uint16_t exact;
+		uint16_t wild;
+	};
+
+	uint16_t addNode(const char* label, uint16_t len);
+	uint16_t findChild(uint16_t node, char c) const;
+	void append(uint16_t& head, uint16_t index);
+	size_t collect(uint16_t head, uint16_t* out, size_t n, size_t max) const;
+
+	std::vector<Node> m_nodes;
+	/**
+	 * Patterns with the same text and kind are chained in table order.
+	 */
+	std::vector<uint16_t> m_next;
+};
+
+}
+
+#endif /* MAIN_ROUTETRIE_HPP_ */
@@ -0,0 +1,315 @@
+/*
+ * rpc.cpp
+ *
+ *  Binary RPC channel over websocket, see rpc.hpp for the wire format.
+ */
+
+#include "rpc.hpp"
+#include "config.hpp"
+
+extern "C" {
+#include "libesphttpd/platform.h"
+}
+
+namespace ecuspy {
+
+namespace {
+
+struct RpcSession {
+	Websock* ws;
+	uint32_t subs;
+	size_t in_len;
+	size_t discard;
+	size_t out_len;
+	uint8_t in[RPC_MAX_FRAME];
+	uint8_t out[RPC_MAX_FRAME];
+	char value[RPC_MAX_FRAME];
+};
+
+RpcSession s_sessions[RPC_MAX_SESSIONS];
+
+/**
+ * Guards session ownership and subscriptions. The httpd callbacks already
+ * hold the httpd lock when they take it, so everybody else has to take the
+ * httpd lock first as well.
+ */
+std::mutex s_lock;
+
+//Union of all session subscriptions, readable without the lock
+std::atomic<uint32_t> s_subscribed{0};
+
+//Call with s_lock held
+void updateSubscribed() {
+	uint32_t subs = 0;
+	for (size_t i = 0; i < RPC_MAX_SESSIONS; i++) {
+		if (s_sessions[i].ws)
+			subs |= s_sessions[i].subs;
+	}
+	s_subscribed = subs;
+}
+
+inline uint16_t get16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+inline void put16(uint8_t* p, uint16_t v) {
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+void flush(RpcSession& s) {
+	if (s.out_len) {
+		cgiWebsocketSend(s.ws, (const char*)s.out, s.out_len, WEBSOCK_FLAG_BIN);
+		s.out_len = 0;
+	}
+}
+
+/**
+ * Queue a reply frame. Replies of one incoming message are coalesced into
+ * as few websocket messages as the output buffer allows.
+ */
+void reply(RpcSession& s, uint8_t op, uint16_t id, RpcStatus_t status,
+		const void* data = nullptr, size_t len = 0) {
+	if (len > RPC_MAX_FRAME - RPC_HEADER_LEN - 1)
+		len = RPC_MAX_FRAME - RPC_HEADER_LEN - 1;
+	if (s.out_len + RPC_HEADER_LEN + 1 + len > sizeof(s.out))
+		flush(s);
+	uint8_t* p = s.out + s.out_len;
+	p[0] = op | rpcOpReply;
+	put16(p + 1, id);
+	put16(p + 3, len + 1);
+	p[5] = status;
+	if (len)
+		memcpy(p + 6, data, len);
+	s.out_len += RPC_HEADER_LEN + 1 + len;
+}
+
+/**
+ * Copy a value out of the frame and check it against the entry.
+ * buff has to hold at least RPC_MAX_FRAME bytes.
+ */
+RpcStatus_t checkValue(size_t index, const uint8_t* value, size_t len, char* buff) {
+	Config& cfg = Config::instance();
+	if (index >= cfg.size())
+		return rpcBadIndex;
+	if (len > cfg.entry(index).value_len)
+		return rpcInvalidValue;
+	memcpy(buff, value, len);
+	buff[len] = 0;
+	return cfg.validate(index, buff) ? rpcOk : rpcInvalidValue;
+}
+
+/**
+ * Walk the entries of a batch-set payload, checking each one and applying it
+ * when asked to. index is left at the entry that failed.
+ */
+RpcStatus_t batchPass(RpcSession& s, const uint8_t* p, size_t len, bool apply, size_t& index) {
+	size_t pos = 1;
+	for (size_t i = 0; i < p[0]; i++) {
+		index = BADINDEX;
+		if (pos + 3 > len)
+			return rpcBadRequest;
+		index = get16(p + pos);
+		size_t vlen = p[pos + 2];
+		if (pos + 3 + vlen > len)
+			return rpcBadRequest;
+		RpcStatus_t rc = checkValue(index, p + pos + 3, vlen, s.value);
+		if (rc != rpcOk)
+			return rc;
+		if (apply)
+			Config::instance().setValueStr(index, s.value);
+		pos += 3 + vlen;
+	}
+	return pos == len ? rpcOk : rpcBadRequest;
+}
+
+void handleBatchSet(RpcSession& s, uint16_t id, const uint8_t* p, size_t len) {
+	size_t index = BADINDEX;
+	if (len < 1) {
+		reply(s, rpcOpBatchSet, id, rpcBadRequest);
+		return;
+	}
+
+	//Nothing is applied unless every entry is valid
+	RpcStatus_t rc = batchPass(s, p, len, false, index);
+	if (rc == rpcOk) {
+		Transaction tr;
+		batchPass(s, p, len, true, index);
+		reply(s, rpcOpBatchSet, id, rpcOk);
+	} else {
+		uint8_t failed[2];
+		put16(failed, index);
+		reply(s, rpcOpBatchSet, id, rc, failed, sizeof(failed));
+	}
+}
+
+void handleFrame(RpcSession& s, const uint8_t* frame) {
+	uint8_t op = frame[0];
+	uint16_t id = get16(frame + 1);
+	size_t len = get16(frame + 3);
+	const uint8_t* p = frame + RPC_HEADER_LEN;
+	Config& cfg = Config::instance();
+
+	switch (op) {
+	case rpcOpGet:
+		if (len != 2)
+			reply(s, op, id, rpcBadRequest);
+		else if (get16(p) >= cfg.size())
+			reply(s, op, id, rpcBadIndex);
+		else {
+			const char* v = cfg.getValueStr(get16(p));
+			reply(s, op, id, rpcOk, v, strlen(v));
+		}
+		break;
+
+	case rpcOpSet:
+		if (len < 2)
+			reply(s, op, id, rpcBadRequest);
+		else {
+			RpcStatus_t rc = checkValue(get16(p), p + 2, len - 2, s.value);
+			if (rc == rpcOk)
+				cfg.setValueStr(get16(p), s.value);
+			reply(s, op, id, rc);
+		}
+		break;
+
+	case rpcOpBatchSet:
+		handleBatchSet(s, id, p, len);
+		break;
+
+	case rpcOpSubscribe:
+	case rpcOpUnsubscribe:
+		if (len != 1 || p[0] >= rpcChTotal)
+			reply(s, op, id, rpcBadRequest);
+		else {
+			std::lock_guard<std::mutex> guard{s_lock};
+			if (op == rpcOpSubscribe)
+				s.subs |= 1 << p[0];
+			else
+				s.subs &= ~(1 << p[0]);
+			updateSubscribed();
+			reply(s, op, id, rpcOk);
+		}
+		break;
+
+	default:
+		reply(s, op, id, rpcBadRequest);
+	}
+}
+
+/**
+ * Frames may span several websocket callbacks and one callback may carry
+ * several frames. Frames larger than RPC_MAX_FRAME are answered with
+ * rpcBadRequest and skipped.
+ */
+void rpcRecv(Websock *ws, char *data, int len, int flags) {
+	RpcSession* s = static_cast<RpcSession*>(ws->userData);
+	const uint8_t* p = (const uint8_t*)data;
+	if (!s) {
+		uint8_t busy[RPC_HEADER_LEN + 1] = {rpcOpReply, 0, 0, 1, 0, rpcNoResources};
+		cgiWebsocketSend(ws, (const char*)busy, sizeof(busy), WEBSOCK_FLAG_BIN);
+		return;
+	}
+
+	while (len > 0) {
+		if (s->discard) {
+			size_t n = s->discard < (size_t)len ? s->discard : len;
+			s->discard -= n;
+			p += n;
+			len -= n;
+			continue;
+		}
+
+		size_t need = RPC_HEADER_LEN;
+		if (s->in_len >= RPC_HEADER_LEN)
+			need += get16(s->in + 3);
+		if (need > RPC_MAX_FRAME) {
+			reply(*s, s->in[0], get16(s->in + 1), rpcBadRequest);
+			s->discard = need - s->in_len;
+			s->in_len = 0;
+			continue;
+		}
+
+		size_t n = need - s->in_len;
+		if (n > (size_t)len)
+			n = len;
+		memcpy(s->in + s->in_len, p, n);
+		s->in_len += n;
+		p += n;
+		len -= n;
+
+		if (s->in_len >= RPC_HEADER_LEN && s->in_len == RPC_HEADER_LEN + get16(s->in + 3)) {
+			handleFrame(*s, s->in);
+			s->in_len = 0;
+		}
+	}
+	flush(*s);
+}
+
+void configChanged(ConfigMask changed, void* arg) {
+	uint8_t mask[sizeof(ConfigMask)];
+	for (size_t i = 0; i < sizeof(mask); i++)
+		mask[i] = changed >> (8 * i);
+	rpcPublish(rpcChConfig, (const char*)mask, sizeof(mask));
+}
+
+void rpcClose(Websock *ws) {
+	std::lock_guard<std::mutex> guard{s_lock};
+	RpcSession* s = static_cast<RpcSession*>(ws->userData);
+	if (s)
+		s->ws = nullptr;
+	ws->userData = nullptr;
+	updateSubscribed();
+}
+
+}
+
+void rpcInit() {
+	Config::instance().subscribe(~ConfigMask(0), configChanged, nullptr);
+}
+
+void rpcWebsocketConnect(Websock *ws) {
+	std::lock_guard<std::mutex> guard{s_lock};
+	ws->userData = nullptr;
+	for (size_t i = 0; i < RPC_MAX_SESSIONS; i++) {
+		RpcSession& s = s_sessions[i];
+		if (!s.ws) {
+			s.ws = ws;
+			s.subs = 0;
+			s.in_len = 0;
+			s.discard = 0;
+			s.out_len = 0;
+			ws->userData = &s;
+			break;
+		}
+	}
+	ws->recvCb = rpcRecv;
+	ws->closeCb = rpcClose;
+}
+
+void rpcPublish(uint8_t channel, const char* data, size_t len) {
+	uint8_t frame[RPC_MAX_FRAME];
+	if (len > RPC_MAX_FRAME - RPC_HEADER_LEN)
+		len = RPC_MAX_FRAME - RPC_HEADER_LEN;
+	frame[0] = rpcOpPush;
+	put16(frame + 1, channel);
+	put16(frame + 3, len);
+	memcpy(frame + RPC_HEADER_LEN, data, len);
+
+	httpdPlatLock();
+	{
+		std::lock_guard<std::mutex> guard{s_lock};
+		for (size_t i = 0; i < RPC_MAX_SESSIONS; i++) {
+			RpcSession& s = s_sessions[i];
+			if (s.ws && (s.subs & (1 << channel)))
+				cgiWebsocketSend(s.ws, (const char*)frame, RPC_HEADER_LEN + len, WEBSOCK_FLAG_BIN);
+		}
+	}
+	httpdPlatUnlock();
+}
+
+bool rpcHasSubscribers(uint8_t channel) {
+	return s_subscribed.load() & (1 << channel);
+}
+
+}
@@ -0,0 +1,101 @@
+/*
+ * rpc.hpp
+ *
+ *  Binary RPC channel over /websocket/ws.cgi.
+ *
+ *  Every binary websocket message carries one or more frames:
+ *
+ *      [op:u8][id:u16][len:u16][payload:len]      (little endian)
+ *
+ *  Requests may be pipelined, each one is answered with a frame carrying
+ *  op|RPC_REPLY, the same id and a status byte as first payload byte.
+ *  Pushes for subscribed channels use op RPC_PUSH and the channel as id.
+ *  Replies and pushes share the socket, the client demultiplexes by op/id.
+ *
+ *  Request payloads:
+ *      RPC_GET        index:u16                  -> status, value
+ *      RPC_SET        index:u16, value           -> status
+ *      RPC_BATCH_SET  count:u8, {index:u16, vlen:u8, value}*count
+ *                                                -> status, index:u16 of the first failure
+ *      RPC_SUBSCRIBE  channel:u8                 -> status
+ *      RPC_UNSUBSCRIBE channel:u8                -> status
+ *
+ *  Push payloads:
+ *      rpcChStatus    text
+ *      rpcChConfig    mask:u64, bit n set when entry n changed
+ *      rpcChSamples   {pid:u8, source:u8, ts:u32, value:f32}, one raw sample
+ *      rpcChAggregates {pid:u8, {count:u16, min, max, mean, p50, p90, p99:f32}
+ *                     for the 1 s, 10 s and 60 s windows}* once a second
+ *      rpcChAlerts    entry:u8, active:u8, pid:u8, ts:u32, value:f32, sent when
+ *                     the rule in Config entry <entry> turns on or off
+ */
+
+#ifndef MAIN_RPC_HPP_
+#define MAIN_RPC_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+extern "C" {
+#include "libesphttpd/cgiwebsocket.h"
+}
+
+namespace ecuspy {
+
+enum RpcOp_t {
+	rpcOpGet = 0x01,
+	rpcOpSet = 0x02,
+	rpcOpBatchSet = 0x03,
+	rpcOpSubscribe = 0x04,
+	rpcOpUnsubscribe = 0x05,
+	rpcOpPush = 0x40,
+	rpcOpReply = 0x80
+};
+
+enum RpcStatus_t {
+	rpcOk,
+	rpcBadRequest,
+	rpcBadIndex,
+	rpcInvalidValue,
+	rpcNoResources
+};
+
+enum RpcChannel_t {
+	rpcChStatus,
+	rpcChConfig,
+	rpcChSamples,
+	rpcChAggregates,
+	rpcChAlerts,
+	rpcChTotal
+};
+
+constexpr size_t RPC_HEADER_LEN = 5;
+constexpr size_t RPC_MAX_FRAME = 512;
+constexpr size_t RPC_MAX_SESSIONS = 4;
+
+/**
+ * Hook the channel up to Config change notifications.
+ * Call once the Config store is initialized.
+ */
+void rpcInit();
+
+/**
+ * Websocket connect handler, install it with ROUTE_WS.
+ */
+void rpcWebsocketConnect(Websock *ws);
+
+/**
+ * Push data to every session subscribed to the channel.
+ * Safe to call from any task.
+ */
+void rpcPublish(uint8_t channel, const char* data, size_t len);
+
+/**
+ * Whether any session is subscribed to the channel, lets producers skip
+ * encoding data nobody asked for.
+ */
+bool rpcHasSubscribers(uint8_t channel);
+
+}
+
+#endif /* MAIN_RPC_HPP_ */
@@ -0,0 +1,255 @@
+/*
+ * rules.cpp
+ *
+ *  Rule compiler and per-sample evaluation, see rules.hpp.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+#include "io.h"
+}
+#include "rules.hpp"
+#include "obd.hpp"
+#include "rpc.hpp"
+#include "dlog.hpp"
+#include "clock.hpp"
+
+namespace ecuspy {
+
+namespace {
+
+bool parseCond(char* tok, uint8_t& pid, uint8_t& op, float& threshold) {
+	char* o = strpbrk(tok, "<>");
+	if (!o || o == tok)
+		return false;
+	bool eq = o[1] == '=';
+	op = *o == '>' ? (eq ? 1 : 0) : (eq ? 3 : 2);
+	*o = 0;
+
+	const PidInfo* info = pidByName(tok);
+	if (info)
+		pid = info->pid;
+	else {
+		char* end;
+		if (strlen(tok) != 2)
+			return false;
+		pid = strtoul(tok, &end, 16);
+		if (*end)
+			return false;
+	}
+
+	char* val = o + (eq ? 2 : 1);
+	char* end;
+	threshold = strtof(val, &end);
+	return end != val && !*end;
+}
+
+}
+
+bool ruleCheck(const ConfigEntry& e, const char* str) {
+	RuleEngine::Rule rule;
+	RuleEngine::Cond conds[RULE_MAX_CONDS];
+	return !*str || RuleEngine::parse(str, rule, conds);
+}
+
+bool RuleEngine::parse(const char* str, Rule& rule, Cond* conds) {
+	char buff[RULE_LEN + 1];
+	char* save;
+	if (strlen(str) > RULE_LEN)
+		return false;
+	strcpy(buff, str);
+
+	memset(&rule, 0, sizeof(rule));
+	char* tok = strtok_r(buff, " ", &save);
+	while (tok) {
+		if (rule.conds == RULE_MAX_CONDS)
+			return false;
+		Cond& c = conds[rule.conds++];
+		c.state = false;
+		if (!parseCond(tok, c.pid, c.op, c.threshold))
+			return false;
+		tok = strtok_r(NULL, " ", &save);
+		if (!tok || strcmp(tok, "and"))
+			break;
+		tok = strtok_r(NULL, " ", &save);
+	}
+	if (!rule.conds)
+		return false;
+
+	char* end;
+	if (tok && !strcmp(tok, "for")) {
+		tok = strtok_r(NULL, " ", &save);
+		if (!tok)
+			return false;
+		rule.duration = strtoul(tok, &end, 10);
+		if (*end)
+			return false;
+		tok = strtok_r(NULL, " ", &save);
+	}
+	if (tok && !strcmp(tok, "hyst")) {
+		tok = strtok_r(NULL, " ", &save);
+		if (!tok)
+			return false;
+		rule.hyst = strtof(tok, &end);
+		if (*end || rule.hyst < 0)
+			return false;
+		tok = strtok_r(NULL, " ", &save);
+	}
+	if (!tok || strcmp(tok, "then"))
+		return false;
+
+	tok = strtok_r(NULL, " ", &save);
+	if (!tok)
+		return false;
+	if (!strcmp(tok, "push"))
+		rule.action = ruleActPush;
+	else if (!strcmp(tok, "log"))
+		rule.action = ruleActLog;
+	else if (!strcmp(tok, "gpio"))
+		rule.action = ruleActGpio;
+	else
+		return false;
+	return strtok_r(NULL, " ", &save) == NULL;
+}
+
+void RuleEngine::compile() {
+	Config& cfg = Config::instance();
+	uint8_t count[256];
+	Event off[RULE_MAX];
+	size_t n = 0;
+	{
+		std::lock_guard<std::mutex> guard{m_lock};
+
+		//Whatever an active rule drives has to be released before its state is lost
+		uint32_t now = clockMs();
+		for (size_t i = 0; i < m_rules_len; i++) {
+			const Rule& r = m_rules[i];
+			if (r.active)
+				off[n++] = Event{r.action, r.entry, false, 0, now, 0};
+		}
+
+		m_rules_len = 0;
+		m_conds_len = 0;
+		for (size_t i = 0; i < cfg.size() && m_rules_len < RULE_MAX; i++) {
+			const char* str = cfg.getValueStr(i);
+			Rule& r = m_rules[m_rules_len];
+			if (cfg.entry(i).check != ruleCheck || !*str || !parse(str, r, m_conds + m_conds_len))
+				continue;
+			r.entry = i;
+			for (size_t c = 0; c < r.conds; c++)
+				m_conds[m_conds_len++].rule = m_rules_len;
+			m_rules_len++;
+		}
+
+		//Counting sort of the conditions by PID
+		memset(count, 0, sizeof(count));
+		for (size_t c = 0; c < m_conds_len; c++)
+			count[m_conds[c].pid]++;
+		m_pid_first[0] = 0;
+		for (size_t p = 0; p < 256; p++)
+			m_pid_first[p + 1] = m_pid_first[p] + count[p];
+		memcpy(count, m_pid_first, sizeof(count));
+		for (size_t c = 0; c < m_conds_len; c++)
+			m_by_pid[count[m_conds[c].pid]++] = c;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		fire(off[i]);
+}
+
+void RuleEngine::start() {
+	Config& cfg = Config::instance();
+	ConfigMask mask = 0;
+	for (size_t i = 0; i < cfg.size(); i++) {
+		if (cfg.entry(i).check == ruleCheck)
+			mask |= Config::maskOf(i);
+	}
+	compile();
+	if (mask)
+		cfg.subscribe(mask, configChanged, this);
+}
+
+void RuleEngine::configChanged(ConfigMask changed, void* arg) {
+	static_cast<RuleEngine*>(arg)->compile();
+}
+
+bool RuleEngine::evalCond(Cond& c, float hyst, float value) {
+	//Once true, a condition holds until the value is hyst past the threshold
+	float h = c.state ? hyst : 0;
+	switch (c.op) {
+	case opGt: c.state = value > c.threshold - h; break;
+	case opGe: c.state = value >= c.threshold - h; break;
+	case opLt: c.state = value < c.threshold + h; break;
+	default: c.state = value <= c.threshold + h; break;
+	}
+	return c.state;
+}
+
+void RuleEngine::sample(uint8_t pid, uint32_t ts, float value) {
+	Event events[RULE_MAX];
+	size_t n = 0;
+	{
+		std::lock_guard<std::mutex> guard{m_lock};
+		size_t first = m_pid_first[pid], last = m_pid_first[pid + 1];
+		if (first == last)
+			return;
+
+		for (size_t k = first; k < last; k++) {
+			Cond& c = m_conds[m_by_pid[k]];
+			Rule& r = m_rules[c.rule];
+			bool was = c.state;
+			if (evalCond(c, r.hyst, value) != was)
+				r.holding += c.state ? 1 : -1;
+		}
+
+		//Second pass once every condition on this PID is up to date
+		for (size_t k = first; k < last; k++) {
+			uint8_t idx = m_conds[m_by_pid[k]].rule;
+			Rule& r = m_rules[idx];
+			if (r.holding == r.conds) {
+				if (!r.timing) {
+					r.timing = true;
+					r.since = ts;
+				}
+				if (!r.active && ts - r.since >= r.duration) {
+					r.active = true;
+					events[n++] = Event{r.action, r.entry, true, pid, ts, value};
+				}
+			} else {
+				r.timing = false;
+				if (r.active) {
+					r.active = false;
+					events[n++] = Event{r.action, r.entry, false, pid, ts, value};
+				}
+			}
+		}
+	}
+
+	//Actions run without the lock, they may block on the network
+	for (size_t i = 0; i < n; i++)
+		fire(events[i]);
+}
+
+void RuleEngine::fire(const Event& ev) {
+	switch (ev.action) {
+	case ruleActPush: {
+		uint8_t buff[3 + sizeof(ev.ts) + sizeof(ev.value)];
+		buff[0] = ev.entry;
+		buff[1] = ev.active;
+		buff[2] = ev.pid;
+		memcpy(buff + 3, &ev.ts, sizeof(ev.ts));
+		memcpy(buff + 3 + sizeof(ev.ts), &ev.value, sizeof(ev.value));
+		rpcPublish(rpcChAlerts, (const char*)buff, sizeof(buff));
+		break;
+	}
+	case ruleActLog:
+		DLOG_I("Rule: %s %s, pid %02x=%.2f", Config::instance().entry(ev.entry).id,
+				ev.active ? "on" : "off", ev.pid, ev.value);
+		break;
+	case ruleActGpio:
+		ioLed(ev.active);
+		break;
+	}
+}
+
+}
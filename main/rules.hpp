@@ -0,0 +1,140 @@
+/*
+ * rules.hpp
+ *
+ *  Alert rules evaluated per sample. Rules are Config entries validated by
+ *  ruleCheck, one rule per entry, empty entries are disabled:
+ *
+ *      <cond> [and <cond>]... [for <ms>] [hyst <h>] then <action>
+ *
+ *      cond    <pid><op><value>, pid by name ("coolant") or two hex digits,
+ *              op one of > >= < <=
+ *      action  push    alert on the rpcChAlerts channel
+ *              log     log marker
+ *              gpio    drive the LED output while the rule is active
+ *
+ *  e.g. "coolant>110 for 5000 then push", "rpm>3000 and speed<1 then gpio".
+ *
+ *  A rule turns active once all its conditions held for <ms>, and clears as
+ *  soon as one of them fails. With hysteresis a condition that turned true
+ *  only turns false again once the value is <h> past the threshold.
+ *  Changing any rule entry recompiles them all; rules active at that point
+ *  turn off, with pid 0 in the event.
+ *
+ *  The rules are compiled into a flat table indexed by PID, so a sample only
+ *  touches the conditions that reference its PID.
+ */
+
+#ifndef MAIN_RULES_HPP_
+#define MAIN_RULES_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+#include "templates.hpp"
+#include "config.hpp"
+
+namespace ecuspy {
+
+constexpr size_t RULE_MAX = 16;
+constexpr size_t RULE_MAX_CONDS = 4;
+constexpr size_t RULE_LEN = 64;
+
+enum RuleAction_t {
+	ruleActPush,
+	ruleActLog,
+	ruleActGpio
+};
+
+/**
+ * Validator for rule entries, use it with CustomValidatorEntry.
+ */
+bool ruleCheck(const ConfigEntry& e, const char* str);
+
+class RuleEngine : public tpl::Singleton<RuleEngine> {
+public:
+	/**
+	 * Compile every rule entry of the Config store and recompile whenever
+	 * one of them changes.
+	 */
+	void start();
+
+	/**
+	 * Rebuild the decision table from Config. Rule state is reset, rules
+	 * that were active fire their action as turning off first.
+	 */
+	void compile();
+
+	void sample(uint8_t pid, uint32_t ts, float value);
+
+	size_t rules() const {
+		return m_rules_len;
+	}
+
+private:
+	friend class Singleton<RuleEngine>;
+	friend bool ruleCheck(const ConfigEntry& e, const char* str);
+
+	RuleEngine() : m_rules_len(0), m_conds_len(0) {}
+
+	enum Op_t {
+		opGt,
+		opGe,
+		opLt,
+		opLe
+	};
+
+	struct Cond {
+		uint8_t pid;
+		uint8_t op;
+		uint8_t rule;
+		bool state;
+		float threshold;
+	};
+
+	struct Rule {
+		uint8_t conds;
+		uint8_t holding;
+		uint8_t action;
+		bool timing;
+		bool active;
+		uint16_t entry;
+		uint32_t duration;
+		uint32_t since;
+		float hyst;
+	};
+
+	/**
+	 * What an action needs of its rule is copied in, the rule table may be
+	 * recompiled once the lock is released.
+	 */
+	struct Event {
+		uint8_t action;
+		uint16_t entry;
+		bool active;
+		uint8_t pid;
+		uint32_t ts;
+		float value;
+	};
+
+	static bool parse(const char* str, Rule& rule, Cond* conds);
+	bool evalCond(Cond& c, float hyst, float value);
+	void fire(const Event& ev);
+	static void configChanged(ConfigMask changed, void* arg);
+
+	Rule m_rules[RULE_MAX];
+	Cond m_conds[RULE_MAX * RULE_MAX_CONDS];
+	/**
+	 * Conditions sorted by PID, m_pid_first[pid] .. m_pid_first[pid + 1]
+	 * are the ones referencing pid.
+	 */
+	uint8_t m_by_pid[RULE_MAX * RULE_MAX_CONDS];
+	uint8_t m_pid_first[257];
+	size_t m_rules_len;
+	size_t m_conds_len;
+	std::mutex m_lock;
+};
+
+}
+
+#endif /* MAIN_RULES_HPP_ */
@@ -0,0 +1,344 @@
+/*
+ * samplelog.cpp
+ *
+ *  Staging, flash ring and range lookup of the sample log, see samplelog.hpp.
+ */
+
+#include "samplelog.hpp"
+
+#include <string.h>
+#include <chrono>
+#include <utility>
+
+namespace ecuspy {
+
+namespace {
+
+constexpr size_t SECTOR = 4096;
+constexpr size_t SECTOR_RECORDS = SECTOR / sizeof(LogRecord);
+
+}
+
+#ifdef ESP32
+
+PartitionLogStore::PartitionLogStore() {
+	m_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "samplelog");
+}
+
+size_t PartitionLogStore::capacity() const {
+	return m_part ? m_part->size / SECTOR * SECTOR_RECORDS : 0;
+}
+
+size_t PartitionLogStore::sectorRecords() const {
+	return SECTOR_RECORDS;
+}
+
+bool PartitionLogStore::erase(size_t pos) {
+	return esp_partition_erase_range(m_part, pos / SECTOR_RECORDS * SECTOR, SECTOR) == ESP_OK;
+}
+
+//Sectors do not hold a whole number of records, runs are split at their ends
+bool PartitionLogStore::write(size_t pos, const LogRecord* records, size_t len) {
+	while (len) {
+		size_t n = SECTOR_RECORDS - pos % SECTOR_RECORDS;
+		n = n < len ? n : len;
+		size_t addr = pos / SECTOR_RECORDS * SECTOR + pos % SECTOR_RECORDS * sizeof(LogRecord);
+		if (esp_partition_write(m_part, addr, records, n * sizeof(LogRecord)) != ESP_OK)
+			return false;
+		pos += n;
+		records += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool PartitionLogStore::read(size_t pos, LogRecord* records, size_t len) {
+	while (len) {
+		size_t n = SECTOR_RECORDS - pos % SECTOR_RECORDS;
+		n = n < len ? n : len;
+		size_t addr = pos / SECTOR_RECORDS * SECTOR + pos % SECTOR_RECORDS * sizeof(LogRecord);
+		if (esp_partition_read(m_part, addr, records, n * sizeof(LogRecord)) != ESP_OK)
+			return false;
+		pos += n;
+		records += n;
+		len -= n;
+	}
+	return true;
+}
+
+LogStore& logStore() {
+	static PartitionLogStore store;
+	return store;
+}
+
+#else
+
+FileLogStore::FileLogStore(const char* path, size_t sectors) : m_sectors(sectors) {
+	m_file = fopen(path, "w+b");
+}
+
+FileLogStore::~FileLogStore() {
+	if (m_file)
+		fclose(m_file);
+}
+
+size_t FileLogStore::capacity() const {
+	return m_file ? m_sectors * SECTOR_RECORDS : 0;
+}
+
+size_t FileLogStore::sectorRecords() const {
+	return SECTOR_RECORDS;
+}
+
+bool FileLogStore::erase(size_t pos) {
+	LogRecord blank[SECTOR_RECORDS];
+	memset(blank, 0xFF, sizeof(blank));
+	return write(pos, blank, SECTOR_RECORDS);
+}
+
+bool FileLogStore::write(size_t pos, const LogRecord* records, size_t len) {
+	return !fseek(m_file, pos * sizeof(LogRecord), SEEK_SET) && fwrite(records, sizeof(LogRecord), len, m_file) == len;
+}
+
+bool FileLogStore::read(size_t pos, LogRecord* records, size_t len) {
+	return !fseek(m_file, pos * sizeof(LogRecord), SEEK_SET) && fread(records, sizeof(LogRecord), len, m_file) == len;
+}
+
+LogStore& logStore() {
+	static FileLogStore store("samplelog.bin", LOG_DEVICE_SECTORS);
+	return store;
+}
+
+#endif
+
+SampleLog::SampleLog() : m_store(nullptr), m_first(0), m_end(0), m_cur(0), m_fill(0), m_pending(0), m_dropped(0),
+		m_slot(0) {
+	memset(m_slots, 0, sizeof(m_slots));
+}
+
+void SampleLog::start(LogStore& store) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	m_store = store.capacity() ? &store : nullptr;
+	m_first = m_end = 0;
+	m_slot = 0;
+	memset(m_slots, 0, sizeof(m_slots));
+}
+
+void SampleLog::append(const Sample& s) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	if (!m_store)
+		return;
+	LogRecord r{s.ts, s.pid, s.source, 0, s.value};
+	uint32_t slot = s.ts / LOG_PID_INTERVAL_MS;
+	if (slot > m_slot) {
+		closeSlot();
+		m_slot = slot;
+	} else if (slot < m_slot) {
+		//Older than the slot already written, keep it as it is
+		stage(r);
+		return;
+	}
+
+	Slot* free = nullptr;
+	for (Slot& e : m_slots) {
+		if (e.used && e.pid == s.pid) {
+			if (s.value < e.min.value)
+				e.min = r;
+			if (s.value > e.max.value)
+				e.max = r;
+			return;
+		}
+		if (!e.used && !free)
+			free = &e;
+	}
+	if (!free) {
+		//More PIDs than slots, close the slot early rather than stage out of order
+		closeSlot();
+		free = m_slots;
+	}
+	*free = Slot{true, s.pid, r, r};
+}
+
+//Stages the kept samples of the slot in time order, the log has to stay sorted
+void SampleLog::closeSlot() {
+	LogRecord out[LOG_SLOT_PIDS * 2];
+	size_t n = 0;
+	for (Slot& e : m_slots) {
+		if (!e.used)
+			continue;
+		const LogRecord* kept[2] = {&e.min, &e.max};
+		if (e.max.ts < e.min.ts)
+			std::swap(kept[0], kept[1]);
+		bool one = e.min.ts == e.max.ts && e.min.value == e.max.value;
+		for (size_t k = 0; k < (one ? 1u : 2u); k++) {
+			size_t i = n++;
+			for (; i && out[i - 1].ts > kept[k]->ts; i--)
+				out[i] = out[i - 1];
+			out[i] = *kept[k];
+		}
+		e.used = false;
+	}
+	for (size_t i = 0; i < n; i++)
+		stage(out[i]);
+}
+
+void SampleLog::stage(const LogRecord& r) {
+	if (m_fill == LOG_BLOCK) {
+		if (m_pending) {
+			m_dropped++;
+			return;
+		}
+		m_pending = m_fill;
+		m_cur ^= 1;
+		m_fill = 0;
+	}
+	m_stage[m_cur][m_fill++] = r;
+	if (m_fill == LOG_BLOCK && !m_pending) {
+		m_pending = m_fill;
+		m_cur ^= 1;
+		m_fill = 0;
+		m_cv.notify_one();
+	}
+}
+
+void SampleLog::waitBlock(uint32_t ms) {
+	std::unique_lock<std::mutex> lock{m_lock};
+	m_cv.wait_for(lock, std::chrono::milliseconds(ms), [this] {return m_pending != 0;});
+}
+
+//Frees the sector a run starts in before writing it, its records drop out of the log first
+bool SampleLog::writeRun(uint32_t seq, const LogRecord* records, size_t len) {
+	size_t cap = m_store->capacity();
+	size_t per = m_store->sectorRecords();
+	while (len) {
+		size_t pos = seq % cap;
+		if (pos % per == 0) {
+			{
+				std::lock_guard<std::mutex> guard{m_lock};
+				if (seq - m_first > cap - per)
+					m_first = seq - (cap - per);
+			}
+			if (!m_store->erase(pos))
+				return false;
+		}
+		size_t n = per - pos % per;
+		n = n < len ? n : len;
+		if (!m_store->write(pos, records, n))
+			return false;
+		seq += n;
+		records += n;
+		len -= n;
+	}
+	return true;
+}
+
+//Only this writes m_end and the pending block, readers see records once they are on flash
+size_t SampleLog::flush() {
+	size_t n;
+	const LogRecord* block;
+	uint32_t seq;
+	{
+		std::lock_guard<std::mutex> guard{m_lock};
+		if (!m_store)
+			return 0;
+		if (!m_pending && m_fill) {
+			m_pending = m_fill;
+			m_cur ^= 1;
+			m_fill = 0;
+		}
+		n = m_pending;
+		block = m_stage[m_cur ^ 1];
+		seq = m_end;
+	}
+	if (!n)
+		return 0;
+	bool ok = writeRun(seq, block, n);
+
+	std::lock_guard<std::mutex> guard{m_lock};
+	if (ok)
+		m_end += n;
+	else
+		m_dropped += n;
+	m_pending = 0;
+	return ok ? n : 0;
+}
+
+uint32_t SampleLog::first() {
+	std::lock_guard<std::mutex> guard{m_lock};
+	return m_first;
+}
+
+uint32_t SampleLog::end() {
+	std::lock_guard<std::mutex> guard{m_lock};
+	return m_end;
+}
+
+bool SampleLog::timeRange(uint32_t& oldest, uint32_t& newest) {
+	uint32_t lo = first(), hi = end();
+	LogRecord r;
+	if (lo == hi || !m_store->read(lo % m_store->capacity(), &r, 1))
+		return false;
+	oldest = r.ts;
+	if (!m_store->read((hi - 1) % m_store->capacity(), &r, 1))
+		return false;
+	newest = r.ts;
+	return true;
+}
+
+uint32_t SampleLog::lowerBound(uint32_t ts) {
+	uint32_t lo = first(), hi = end();
+	LogRecord r;
+	while (lo != hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (!m_store->read(mid % m_store->capacity(), &r, 1))
+			break;
+		if (r.ts < ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+size_t SampleLog::read(uint32_t& seq, LogRecord* out, size_t max) {
+	for (;;) {
+		uint32_t avail;
+		{
+			std::lock_guard<std::mutex> guard{m_lock};
+			if (!m_store)
+				return 0;
+			if ((int32_t)(seq - m_first) < 0)
+				seq = m_first;
+			avail = m_end - seq;
+		}
+		size_t pos = seq % m_store->capacity();
+		size_t n = m_store->capacity() - pos;
+		n = n < max ? n : max;
+		n = n < avail ? n : avail;
+		if (!n || !m_store->read(pos, out, n))
+			return 0;
+
+		//The flusher may have reused the sector meanwhile
+		uint32_t skip;
+		{
+			std::lock_guard<std::mutex> guard{m_lock};
+			skip = (int32_t)(m_first - seq) > 0 ? m_first - seq : 0;
+		}
+		if (skip < n) {
+			memmove(out, out + skip, (n - skip) * sizeof(LogRecord));
+			seq += n;
+			return n - skip;
+		}
+		seq += n;
+	}
+}
+
+void sampleLogTask(void*) {
+	SampleLog& log = SampleLog::instance();
+	for (;;) {
+		log.waitBlock(LOG_FLUSH_MS);
+		log.flush();
+	}
+}
+
+}
@@ -0,0 +1,215 @@
+/*
+ * samplelog.hpp
+ *
+ *  Recorder for the merged sample stream. Records are staged in RAM and
+ *  written out a block at a time by the samplelog task into a ring on the
+ *  "samplelog" flash partition, oldest erase sector first once it is full.
+ *  The stream is in timestamp order (see merge.hpp), so the log is too and
+ *  a time range is found by binary search.
+ *
+ *  Records are addressed by sequence number, which keeps counting across
+ *  wraps; the log starts empty at boot as the clock does.
+ *
+ *  To make the partition last, a PID is logged as the lowest and the
+ *  highest sample of every LOG_PID_INTERVAL_MS slot, so peaks and dips
+ *  survive for the chart queries. What a chart loses is the samples in
+ *  between: within a slot the shape is reduced to those two points, raw
+ *  export returns at most two per PID per slot, and a slot is written only
+ *  once the stream reaches the next one. With the five PIDs the firmware
+ *  polls that is at most 5 records/s, and the 48 sectors (16368 records)
+ *  hold 55 minutes. Every sector is erased once per wrap, one sector every
+ *  68 s, so a sector sees about 26 erases per day of continuous logging
+ *  and its 100k cycles last about ten years of it.
+ */
+
+#ifndef MAIN_SAMPLELOG_HPP_
+#define MAIN_SAMPLELOG_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef ESP32
+#include "esp_partition.h"
+#endif
+
+#include "templates.hpp"
+#include "samples.hpp"
+
+namespace ecuspy {
+
+constexpr size_t LOG_BLOCK = 64;
+constexpr uint32_t LOG_FLUSH_MS = 1000;
+constexpr uint32_t LOG_PID_INTERVAL_MS = 2000;
+/**
+ * PIDs reduced per slot; a further PID closes the slot early.
+ */
+constexpr size_t LOG_SLOT_PIDS = 16;
+/**
+ * Sectors of the samplelog partition in partitions.csv, host benchmarks
+ * size their store with it.
+ */
+constexpr size_t LOG_DEVICE_SECTORS = 48;
+
+struct LogRecord {
+	uint32_t ts;
+	uint8_t pid;
+	uint8_t source;
+	uint16_t reserved;
+	float value;
+};
+
+static_assert(sizeof(LogRecord) == 12, "LogRecord is stored as is");
+
+/**
+ * Record storage. Positions are record indices below capacity(), which
+ * is a multiple of sectorRecords(); a sector is erased before it is
+ * written again. Runs passed to read() and write() do not wrap.
+ */
+class LogStore {
+public:
+	virtual ~LogStore() {}
+
+	virtual size_t capacity() const = 0;
+	virtual size_t sectorRecords() const = 0;
+	virtual bool erase(size_t pos) = 0;
+	virtual bool write(size_t pos, const LogRecord* records, size_t len) = 0;
+	virtual bool read(size_t pos, LogRecord* records, size_t len) = 0;
+};
+
+#ifdef ESP32
+/**
+ * The "samplelog" data partition, 4 KB sectors holding 341 records each.
+ */
+class PartitionLogStore : public LogStore {
+public:
+	PartitionLogStore();
+
+	size_t capacity() const override;
+	size_t sectorRecords() const override;
+	bool erase(size_t pos) override;
+	bool write(size_t pos, const LogRecord* records, size_t len) override;
+	bool read(size_t pos, LogRecord* records, size_t len) override;
+
+private:
+	const esp_partition_t* m_part;
+};
+#else
+/**
+ * Host shim: a file of records.
+ */
+class FileLogStore : public LogStore {
+public:
+	FileLogStore(const char* path, size_t sectors);
+	~FileLogStore();
+
+	size_t capacity() const override;
+	size_t sectorRecords() const override;
+	bool erase(size_t pos) override;
+	bool write(size_t pos, const LogRecord* records, size_t len) override;
+	bool read(size_t pos, LogRecord* records, size_t len) override;
+
+private:
+	FILE* m_file;
+	size_t m_sectors;
+};
+#endif
+
+/**
+ * The platform's log storage.
+ */
+LogStore& logStore();
+
+class SampleLog : public tpl::Singleton<SampleLog> {
+public:
+	void start(LogStore& store);
+
+	/**
+	 * Add a sample, called from samplePublish. It is kept if it is the
+	 * lowest or the highest of its PID in the current LOG_PID_INTERVAL_MS
+	 * slot; the slot's records are staged once a sample of a later slot
+	 * comes in. Records are dropped and counted while both staging blocks
+	 * wait for the flash.
+	 */
+	void append(const Sample& s);
+
+	/**
+	 * Write the staged samples out, returns the number written.
+	 */
+	size_t flush();
+
+	/**
+	 * Wait up to ms for a full block to be staged.
+	 */
+	void waitBlock(uint32_t ms);
+
+	/**
+	 * Sequence numbers of the oldest record and of the next one.
+	 */
+	uint32_t first();
+	uint32_t end();
+
+	/**
+	 * Timestamps of the oldest and the newest record, false while empty.
+	 */
+	bool timeRange(uint32_t& oldest, uint32_t& newest);
+
+	/**
+	 * Sequence number of the first record at or after ts.
+	 */
+	uint32_t lowerBound(uint32_t ts);
+
+	/**
+	 * Read up to max records starting at seq, which is moved past them.
+	 * Overwritten records are skipped, 0 means seq reached end().
+	 */
+	size_t read(uint32_t& seq, LogRecord* out, size_t max);
+
+	uint32_t dropped() const {
+		return m_dropped;
+	}
+
+private:
+	friend class Singleton<SampleLog>;
+
+	SampleLog();
+
+	/**
+	 * Lowest and highest sample of a PID in the current slot.
+	 */
+	struct Slot {
+		bool used;
+		uint8_t pid;
+		LogRecord min;
+		LogRecord max;
+	};
+
+	void closeSlot();
+	void stage(const LogRecord& r);
+	bool writeRun(uint32_t seq, const LogRecord* records, size_t len);
+
+	LogStore* m_store;
+	uint32_t m_first;
+	uint32_t m_end;
+	LogRecord m_stage[2][LOG_BLOCK];
+	uint8_t m_cur;
+	size_t m_fill;
+	size_t m_pending;
+	uint32_t m_dropped;
+	uint32_t m_slot;
+	Slot m_slots[LOG_SLOT_PIDS];
+	std::mutex m_lock;
+	std::condition_variable m_cv;
+};
+
+/**
+ * Task body for the Topology table, flushes every LOG_FLUSH_MS and
+ * whenever a block fills.
+ */
+void sampleLogTask(void* arg);
+
+}
+
+#endif /* MAIN_SAMPLELOG_HPP_ */
@@ -0,0 +1,77 @@
+/*
+ * samples.cpp
+ *
+ *  Sample fan-out and wire encoding of the sample channels, see rpc.hpp.
+ */
+
+extern "C" {
+#include <libesphttpd/esp.h>
+}
+#include "samples.hpp"
+#include "aggregate.hpp"
+#include "rpc.hpp"
+#include "rules.hpp"
+#include "samplelog.hpp"
+#include "clock.hpp"
+
+namespace ecuspy {
+
+namespace {
+
+constexpr size_t AGG_RECORD = 1 + AGG_WINDOWS * (2 + 6 * sizeof(float));
+
+uint8_t* put(uint8_t* p, const void* v, size_t len) {
+	memcpy(p, v, len);
+	return p + len;
+}
+
+}
+
+uint32_t sampleClockMs() {
+	return clockMs();
+}
+
+void samplePublish(const Sample& s) {
+	Aggregator::instance().add(s.pid, s.ts, s.value);
+	RuleEngine::instance().sample(s.pid, s.ts, s.value);
+	SampleLog::instance().append(s);
+
+	if (rpcHasSubscribers(rpcChSamples)) {
+		uint8_t buff[10];
+		uint8_t* p = buff;
+		*p++ = s.pid;
+		*p++ = s.source;
+		p = put(p, &s.ts, sizeof(s.ts));
+		p = put(p, &s.value, sizeof(s.value));
+		rpcPublish(rpcChSamples, (const char*)buff, p - buff);
+	}
+}
+
+void samplePublishAggregates(uint32_t now) {
+	uint8_t pids[AGG_MAX_PIDS];
+	WindowStats st[AGG_MAX_PIDS * AGG_WINDOWS];
+	uint8_t buff[RPC_MAX_FRAME - RPC_HEADER_LEN];
+	uint8_t* p = buff;
+
+	if (!rpcHasSubscribers(rpcChAggregates))
+		return;
+
+	size_t n = Aggregator::instance().snapshot(now, pids, st, AGG_MAX_PIDS);
+	for (size_t i = 0; i < n; i++) {
+		if (p + AGG_RECORD > buff + sizeof(buff)) {
+			rpcPublish(rpcChAggregates, (const char*)buff, p - buff);
+			p = buff;
+		}
+		*p++ = pids[i];
+		for (size_t w = 0; w < AGG_WINDOWS; w++) {
+			const WindowStats& ws = st[i * AGG_WINDOWS + w];
+			float v[] = {ws.min, ws.max, ws.mean, ws.p50, ws.p90, ws.p99};
+			p = put(p, &ws.count, sizeof(ws.count));
+			p = put(p, v, sizeof(v));
+		}
+	}
+	if (p != buff)
+		rpcPublish(rpcChAggregates, (const char*)buff, p - buff);
+}
+
+}
@@ -0,0 +1,35 @@
+/*
+ * samples.hpp
+ *
+ *  Entry point for acquired samples. Acquisition hands every decoded
+ *  value to samplePublish, which feeds the window aggregation, the sample
+ *  log and the raw sample channel; the broadcaster pushes aggregates once
+ *  a second.
+ */
+
+#ifndef MAIN_SAMPLES_HPP_
+#define MAIN_SAMPLES_HPP_
+
+#include <stdint.h>
+
+namespace ecuspy {
+
+struct Sample {
+	uint32_t ts;
+	uint8_t pid;
+	uint8_t source;
+	float value;
+};
+
+/**
+ * Millisecond timestamp all samples are taken against.
+ */
+uint32_t sampleClockMs();
+
+void samplePublish(const Sample& s);
+
+void samplePublishAggregates(uint32_t now);
+
+}
+
+#endif /* MAIN_SAMPLES_HPP_ */
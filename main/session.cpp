@@ -0,0 +1,159 @@
+/*
+ * session.cpp
+ *
+ *  Adapter session task, command queue and statistics, see session.hpp.
+ */
+
+#include "session.hpp"
+#include "merge.hpp"
+#include "dtc.hpp"
+#include "obd.hpp"
+#include "clock.hpp"
+
+#include <string.h>
+
+namespace ecuspy {
+
+namespace {
+
+AdapterSession* const* s_sessions;
+size_t s_sessions_len;
+
+}
+
+AdapterSession::AdapterSession(uint8_t source, ObdAdapter& adapter, const uint8_t* pids, size_t len,
+		uint32_t periodUs) :
+		m_source(source), m_adapter(adapter), m_pids(pids), m_pids_len(len), m_next(0), m_started(0),
+		m_period(periodUs), m_tick(adapter.name(), periodUs),
+		m_queue_head(0), m_queue_len(0), m_requests(0), m_responses(0), m_errors(0), m_samples(0),
+		m_commands(0), m_total_us(0), m_max_us(0) {}
+
+int AdapterSession::timed(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max,
+		uint64_t& mid) {
+	uint64_t t0 = clockUs();
+	int n = m_adapter.request(mode, args, len, out, max);
+	uint64_t t1 = clockUs();
+	mid = (t0 + t1) / 2;
+
+	std::lock_guard<std::mutex> guard{m_lock};
+	uint32_t us = t1 - t0;
+	m_requests++;
+	if (n < 0)
+		m_errors++;
+	else
+		m_responses += n;
+	m_total_us += us;
+	if (us > m_max_us)
+		m_max_us = us;
+	return n;
+}
+
+void AdapterSession::poll() {
+	ObdResponse resp[OBD_MAX_ECUS];
+	Sample samples[OBD_MAX_ECUS];
+	size_t k = 0;
+	uint64_t mid;
+
+	uint8_t pid = m_pids[m_next++ % m_pids_len];
+	const PidInfo* info = pidInfo(pid);
+	int n = timed(0x01, &pid, 1, resp, OBD_MAX_ECUS, mid);
+	for (int i = 0; i < n; i++) {
+		const ObdResponse& r = resp[i];
+		if (!r.len || r.data[0] != pid)
+			continue;
+		if (pid == 0x01 && r.len >= 2)
+			DtcCache::instance().milStatus(r.ecu, r.data[1]);
+		else if (info && r.len >= 1 + info->bytes)
+			samples[k++] = Sample{(uint32_t)(mid / 1000), pid, m_source, pidDecode(*info, r.data + 1)};
+	}
+	//The next request starts after now, so does its midpoint
+	SampleMerger::instance().push(m_source, samples, k, clockMs());
+
+	std::lock_guard<std::mutex> guard{m_lock};
+	m_samples += k;
+}
+
+void AdapterSession::run() {
+	m_started = clockUs();
+	for (;;) {
+		Command* c = nullptr;
+		if (m_period && m_pids_len)
+			m_tick.wait();
+		{
+			std::unique_lock<std::mutex> lock{m_lock};
+			if (!m_pids_len)
+				m_cv.wait(lock, [this] {return m_queue_len != 0;});
+			if (m_queue_len) {
+				c = m_queue[m_queue_head];
+				m_queue_head = (m_queue_head + 1) % SESSION_QUEUE;
+				m_queue_len--;
+				m_cv.notify_all();
+			}
+		}
+		if (!c) {
+			poll();
+			continue;
+		}
+		uint64_t mid;
+		int n = timed(c->mode, c->args, c->len, c->out, c->max, mid);
+		std::lock_guard<std::mutex> guard{m_lock};
+		m_commands++;
+		c->result = n;
+		c->done = true;
+		m_cv.notify_all();
+	}
+}
+
+int AdapterSession::request(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max) {
+	if (len > SESSION_MAX_ARGS)
+		return -1;
+	Command c;
+	c.mode = mode;
+	memcpy(c.args, args, len);
+	c.len = len;
+	c.out = out;
+	c.max = max;
+	c.result = -1;
+	c.done = false;
+
+	std::unique_lock<std::mutex> lock{m_lock};
+	m_cv.wait(lock, [this] {return m_queue_len < SESSION_QUEUE;});
+	m_queue[(m_queue_head + m_queue_len++) % SESSION_QUEUE] = &c;
+	m_cv.notify_all();
+	m_cv.wait(lock, [&c] {return c.done;});
+	return c.result;
+}
+
+SessionStats AdapterSession::stats() {
+	std::lock_guard<std::mutex> guard{m_lock};
+	uint64_t up = m_started ? clockUs() - m_started : 0;
+	SessionStats st;
+	st.name = name();
+	st.requests = m_requests;
+	st.responses = m_responses;
+	st.errors = m_errors;
+	st.samples = m_samples;
+	st.commands = m_commands;
+	st.avg_us = m_requests ? m_total_us / m_requests : 0;
+	st.max_us = m_max_us;
+	st.rate = up ? m_requests * 100000000ULL / up : 0;
+	return st;
+}
+
+void sessionTask(void* arg) {
+	static_cast<AdapterSession*>(arg)->run();
+}
+
+void sessionRegister(AdapterSession* const* sessions, size_t len) {
+	s_sessions = sessions;
+	s_sessions_len = len;
+}
+
+size_t sessionStats(SessionStats* out, size_t max) {
+	size_t n = s_sessions_len < max ? s_sessions_len : max;
+	for (size_t i = 0; i < n; i++)
+		out[i] = s_sessions[i]->stats();
+	return n;
+}
+
+}
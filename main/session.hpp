@@ -0,0 +1,122 @@
+/*
+ * session.hpp
+ *
+ *  One adapter session per physical adapter. The session task owns the
+ *  adapter: it runs queued commands first and polls its PID list in
+ *  between. Polled values are stamped with clockUs() at the midpoint of
+ *  the request round trip, which is where the ECU answered give or take
+ *  half the round trip asymmetry, so samples of different buses line up.
+ *  They go to the SampleMerger under the session index as source.
+ *
+ *  With a poll period, polls go out on a PeriodicTimer grid instead of
+ *  back to back, one request per period; queued commands then wait for
+ *  the next tick.
+ *
+ *  Other tasks talk to the bus through the session, which implements
+ *  ObdAdapter by queueing the request and waiting for the session task.
+ *  Mode 01 PID 01 answers go to the DtcCache instead of the samples.
+ */
+
+#ifndef MAIN_SESSION_HPP_
+#define MAIN_SESSION_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <condition_variable>
+
+#include "adapter.hpp"
+#include "clock.hpp"
+
+namespace ecuspy {
+
+constexpr size_t SESSION_QUEUE = 4;
+constexpr size_t SESSION_MAX_ARGS = 4;
+
+struct SessionStats {
+	const char* name;
+	uint32_t requests;
+	uint32_t responses;
+	uint32_t errors;
+	uint32_t samples;
+	uint32_t commands;
+	uint32_t avg_us;
+	uint32_t max_us;
+	/**
+	 * Requests per second since the session started, x100.
+	 */
+	uint32_t rate;
+};
+
+class AdapterSession : public ObdAdapter {
+public:
+	/**
+	 * periodUs paces the requests, 0 polls as fast as the adapter answers.
+	 */
+	AdapterSession(uint8_t source, ObdAdapter& adapter, const uint8_t* pids, size_t len, uint32_t periodUs = 0);
+
+	/**
+	 * Session task body, never returns.
+	 */
+	void run();
+
+	int request(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max) override;
+
+	const char* name() const override {
+		return m_adapter.name();
+	}
+
+	SessionStats stats();
+
+private:
+	struct Command {
+		uint8_t mode;
+		uint8_t args[SESSION_MAX_ARGS];
+		uint8_t len;
+		ObdResponse* out;
+		size_t max;
+		int result;
+		bool done;
+	};
+
+	int timed(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max, uint64_t& mid);
+	void poll();
+
+	uint8_t m_source;
+	ObdAdapter& m_adapter;
+	const uint8_t* m_pids;
+	size_t m_pids_len;
+	size_t m_next;
+	uint64_t m_started;
+	uint32_t m_period;
+	PeriodicTimer m_tick;
+
+	Command* m_queue[SESSION_QUEUE];
+	size_t m_queue_head;
+	size_t m_queue_len;
+	std::mutex m_lock;
+	std::condition_variable m_cv;
+
+	uint32_t m_requests;
+	uint32_t m_responses;
+	uint32_t m_errors;
+	uint32_t m_samples;
+	uint32_t m_commands;
+	uint64_t m_total_us;
+	uint32_t m_max_us;
+};
+
+/**
+ * Task body for the Topology table, arg is the AdapterSession.
+ */
+void sessionTask(void* arg);
+
+/**
+ * Sessions /adapters.json reports on, set once at startup.
+ */
+void sessionRegister(AdapterSession* const* sessions, size_t len);
+size_t sessionStats(SessionStats* out, size_t max);
+
+}
+
+#endif /* MAIN_SESSION_HPP_ */
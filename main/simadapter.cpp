@@ -0,0 +1,164 @@
+/*
+ * simadapter.cpp
+ *
+ *  Simulated ECUs behind the ObdAdapter interface, see simadapter.hpp.
+ */
+
+#include "simadapter.hpp"
+#include "obd.hpp"
+#include "clock.hpp"
+
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+
+namespace ecuspy {
+
+SimAdapter::SimAdapter(const char* name, uint32_t latencyUs) : m_name(name), m_latency(latencyUs),
+		m_len(0), m_requests(0) {}
+
+SimAdapter::SimEcu* SimAdapter::ecu(uint16_t addr) {
+	for (size_t i = 0; i < m_len; i++) {
+		if (m_ecus[i].addr == addr)
+			return &m_ecus[i];
+	}
+	return nullptr;
+}
+
+int SimAdapter::dtcSlot(uint8_t mode) {
+	switch (mode) {
+	case 0x03: return 0;
+	case 0x07: return 1;
+	case 0x0A: return 2;
+	}
+	return -1;
+}
+
+bool SimAdapter::addEcu(uint16_t addr) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	if (ecu(addr))
+		return true;
+	if (m_len == OBD_MAX_ECUS)
+		return false;
+	SimEcu& e = m_ecus[m_len++];
+	memset(&e, 0, sizeof(e));
+	e.addr = addr;
+	return true;
+}
+
+void SimAdapter::setPid(uint16_t addr, uint8_t pid, float base, float amplitude, uint32_t periodMs) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	SimEcu* e = ecu(addr);
+	if (!e)
+		return;
+	size_t i = 0;
+	while (i < e->pids && e->pid[i].pid != pid)
+		i++;
+	if (i == SIM_MAX_PIDS)
+		return;
+	e->pid[i] = SimPid{pid, base, amplitude, periodMs};
+	if (i == e->pids)
+		e->pids++;
+}
+
+void SimAdapter::setDtcs(uint16_t addr, uint8_t mode, const uint16_t* codes, size_t len) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	SimEcu* e = ecu(addr);
+	int slot = dtcSlot(mode);
+	if (!e || slot < 0)
+		return;
+	e->dtcs[slot] = len < SIM_MAX_DTCS ? len : SIM_MAX_DTCS;
+	memcpy(e->dtc[slot], codes, e->dtcs[slot] * sizeof(uint16_t));
+}
+
+void SimAdapter::setMil(uint16_t addr, bool on) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	SimEcu* e = ecu(addr);
+	if (e)
+		e->mil = on;
+}
+
+//Encodes the current value of pid the way the ECU would send it
+bool SimAdapter::pidData(const SimEcu& e, uint8_t pid, uint8_t* out, uint8_t& len) {
+	if (pid == 0x01) {
+		out[0] = (e.mil ? 0x80 : 0) | (e.dtcs[0] & 0x7F);
+		out[1] = out[2] = out[3] = 0;
+		len = 4;
+		return true;
+	}
+	const PidInfo* info = pidInfo(pid);
+	if (!info)
+		return false;
+	for (size_t i = 0; i < e.pids; i++) {
+		const SimPid& p = e.pid[i];
+		if (p.pid != pid)
+			continue;
+		float v = p.base;
+		if (p.period)
+			v += p.amplitude * sinf(2 * (float)M_PI * (clockMs() % p.period) / p.period);
+		v = v < info->lo ? info->lo : v > info->hi ? info->hi : v;
+		uint32_t raw = lroundf((v - info->offset) / info->scale);
+		if (info->bytes == 2) {
+			out[0] = raw >> 8;
+			out[1] = raw;
+		} else
+			out[0] = raw;
+		len = info->bytes;
+		return true;
+	}
+	return false;
+}
+
+int SimAdapter::request(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max) {
+	m_requests++;
+	//The ECUs answer halfway through the round trip
+	std::this_thread::sleep_for(std::chrono::microseconds(m_latency / 2));
+	int n = answer(mode, args, len, out, max);
+	std::this_thread::sleep_for(std::chrono::microseconds(m_latency - m_latency / 2));
+	return n;
+}
+
+int SimAdapter::answer(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max) {
+	std::lock_guard<std::mutex> guard{m_lock};
+	int slot = dtcSlot(mode);
+	size_t n = 0;
+	for (size_t i = 0; i < m_len && n < max; i++) {
+		const SimEcu& e = m_ecus[i];
+		ObdResponse& r = out[n];
+		r.ecu = e.addr;
+		if (slot >= 0) {
+			r.data[0] = e.dtcs[slot];
+			for (size_t d = 0; d < e.dtcs[slot]; d++) {
+				r.data[1 + d * 2] = e.dtc[slot][d] >> 8;
+				r.data[2 + d * 2] = e.dtc[slot][d];
+			}
+			r.len = 1 + e.dtcs[slot] * 2;
+			n++;
+		} else if (mode == 0x01 && len >= 1) {
+			r.data[0] = args[0];
+			if (pidData(e, args[0], r.data + 1, r.len)) {
+				r.len++;
+				n++;
+			}
+		} else if (mode == 0x02 && len >= 2) {
+			//Freeze frame 0 only, frozen values are the current ones
+			if (!e.dtcs[0] || args[1])
+				continue;
+			r.data[0] = args[0];
+			r.data[1] = args[1];
+			if (args[0] == 0x02) {
+				r.data[2] = e.dtc[0][0] >> 8;
+				r.data[3] = e.dtc[0][0];
+				r.len = 4;
+				n++;
+			} else if (pidData(e, args[0], r.data + 2, r.len)) {
+				r.len += 2;
+				n++;
+			}
+		}
+	}
+	return n;
+}
+
+}
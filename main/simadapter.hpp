@@ -0,0 +1,91 @@
+/*
+ * simadapter.hpp
+ *
+ *  Simulated adapter: a set of ECUs with PID values, DTCs and a MIL,
+ *  answering halfway through a fixed latency like an ELM327 round trip.
+ *  Stands in for the real adapter on the host and until the ELM327
+ *  transport exists.
+ */
+
+#ifndef MAIN_SIMADAPTER_HPP_
+#define MAIN_SIMADAPTER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+
+#include "adapter.hpp"
+
+namespace ecuspy {
+
+constexpr size_t SIM_MAX_PIDS = 16;
+constexpr size_t SIM_MAX_DTCS = 8;
+
+class SimAdapter : public ObdAdapter {
+public:
+	SimAdapter(const char* name, uint32_t latencyUs);
+
+	/**
+	 * Returns false once OBD_MAX_ECUS are there.
+	 */
+	bool addEcu(uint16_t ecu);
+
+	/**
+	 * value = base + amplitude * sin(2 pi t / period), a constant without
+	 * period.
+	 */
+	void setPid(uint16_t ecu, uint8_t pid, float base, float amplitude = 0, uint32_t periodMs = 0);
+
+	/**
+	 * DTCs reported for mode 03, 07 or 0A.
+	 */
+	void setDtcs(uint16_t ecu, uint8_t mode, const uint16_t* codes, size_t len);
+	void setMil(uint16_t ecu, bool on);
+
+	/**
+	 * Requests seen so far, i.e. bus traffic.
+	 */
+	uint32_t requests() const {
+		return m_requests.load();
+	}
+
+	int request(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max) override;
+
+	const char* name() const override {
+		return m_name;
+	}
+
+private:
+	struct SimPid {
+		uint8_t pid;
+		float base;
+		float amplitude;
+		uint32_t period;
+	};
+
+	struct SimEcu {
+		uint16_t addr;
+		bool mil;
+		uint8_t pids;
+		SimPid pid[SIM_MAX_PIDS];
+		uint8_t dtcs[3];
+		uint16_t dtc[3][SIM_MAX_DTCS];
+	};
+
+	SimEcu* ecu(uint16_t addr);
+	bool pidData(const SimEcu& e, uint8_t pid, uint8_t* out, uint8_t& len);
+	int answer(uint8_t mode, const uint8_t* args, size_t len, ObdResponse* out, size_t max);
+	static int dtcSlot(uint8_t mode);
+
+	const char* m_name;
+	uint32_t m_latency;
+	SimEcu m_ecus[OBD_MAX_ECUS];
+	size_t m_len;
+	std::atomic<uint32_t> m_requests;
+	std::mutex m_lock;
+};
+
+}
+
+#endif /* MAIN_SIMADAPTER_HPP_ */
@@ -0,0 +1,269 @@
+/*
+ * tasks.cpp
+ *
+ *  Task topology backends: FreeRTOS pinned tasks on the ESP32, pthreads
+ *  with CPU affinity on the host build.
+ */
+
+#include "tasks.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+#endif
+
+namespace ecuspy {
+
+namespace {
+
+#ifndef ESP32
+constexpr uint8_t STACK_FILL = 0xA5;
+
+struct HostTask {
+	pthread_t thread;
+	uint8_t* stack;
+	size_t size;
+	void (*fn)(void*);
+	void* arg;
+};
+
+struct timespec s_started;
+
+void* hostEntry(void* arg) {
+	HostTask* t = static_cast<HostTask*>(arg);
+	t->fn(t->arg);
+	return nullptr;
+}
+
+uint64_t elapsedUs(const struct timespec& from, const struct timespec& to) {
+	return (to.tv_sec - from.tv_sec) * 1000000ULL + (to.tv_nsec - from.tv_nsec) / 1000;
+}
+#endif
+
+}
+
+size_t Topology::start(const TaskSpec* specs, size_t len) {
+	size_t failed = 0;
+#ifndef ESP32
+	if (!m_len)
+		clock_gettime(CLOCK_MONOTONIC, &s_started);
+#endif
+	for (size_t i = 0; i < len; i++) {
+		if (m_len == TASK_MAX) {
+			failed += len - i;
+			break;
+		}
+		Task& t = m_tasks[m_len];
+		t.spec = specs[i];
+		t.handle = nullptr;
+		if (create(t))
+			m_len++;
+		else {
+			printf("Topology: can't start %s\n", t.spec.name);
+			failed++;
+		}
+	}
+	return failed;
+}
+
+#ifdef ESP32
+
+bool Topology::create(Task& t) {
+	TaskHandle_t handle = nullptr;
+	BaseType_t core = t.spec.core < 0 || t.spec.core >= portNUM_PROCESSORS ?
+			tskNO_AFFINITY : t.spec.core;
+	if (xTaskCreatePinnedToCore(t.spec.fn, t.spec.name, t.spec.stack, t.spec.arg,
+			t.spec.prio, &handle, core) != pdPASS)
+		return false;
+	t.handle = handle;
+	return true;
+}
+
+size_t Topology::stats(TaskStats* out, size_t max) const {
+	size_t n = 0;
+#if configUSE_TRACE_FACILITY
+	UBaseType_t count = uxTaskGetNumberOfTasks();
+	TaskStatus_t* status = new TaskStatus_t[count];
+	uint32_t total = 0;
+	count = uxTaskGetSystemState(status, count, &total);
+	for (UBaseType_t i = 0; i < count && n < max; i++, n++) {
+		out[n].name = status[i].pcTaskName;
+		out[n].core = status[i].xCoreID == tskNO_AFFINITY ? TASK_ANY_CORE : status[i].xCoreID;
+		out[n].prio = status[i].uxCurrentPriority;
+		out[n].cpu = status[i].ulRunTimeCounter;
+		//Both cores count towards the total
+		out[n].cpu_pct = total ? (uint64_t)status[i].ulRunTimeCounter * 100 / total / portNUM_PROCESSORS : 0;
+		out[n].stack_free = status[i].usStackHighWaterMark;
+	}
+	delete [] status;
+	n = count;
+#else
+	for (; n < m_len && n < max; n++) {
+		const Task& t = m_tasks[n];
+		out[n].name = t.spec.name;
+		out[n].core = t.spec.core;
+		out[n].prio = t.spec.prio;
+		out[n].cpu = 0;
+		out[n].cpu_pct = 0;
+		out[n].stack_free = uxTaskGetStackHighWaterMark((TaskHandle_t)t.handle);
+	}
+	n = m_len;
+#endif
+	return n;
+}
+
+TaskThread::TaskThread() : m_fn(nullptr), m_arg(nullptr), m_done(NULL) {}
+
+TaskThread::~TaskThread() {
+	join();
+}
+
+void TaskThread::entry(void* arg) {
+	TaskThread* t = static_cast<TaskThread*>(arg);
+	t->m_fn(t->m_arg);
+	xSemaphoreGive(t->m_done);
+	vTaskDelete(NULL);
+}
+
+bool TaskThread::start(const TaskSpec& spec) {
+	m_fn = spec.fn;
+	m_arg = spec.arg;
+	m_done = xSemaphoreCreateBinary();
+	if (!m_done)
+		return false;
+	BaseType_t core = spec.core < 0 || spec.core >= portNUM_PROCESSORS ? tskNO_AFFINITY : spec.core;
+	if (xTaskCreatePinnedToCore(entry, spec.name, spec.stack, this, spec.prio, NULL, core) != pdPASS) {
+		vSemaphoreDelete(m_done);
+		m_done = NULL;
+		return false;
+	}
+	return true;
+}
+
+void TaskThread::join() {
+	if (!m_done)
+		return;
+	xSemaphoreTake(m_done, portMAX_DELAY);
+	vSemaphoreDelete(m_done);
+	m_done = NULL;
+}
+
+bool TaskThread::joinable() const {
+	return m_done != NULL;
+}
+
+#else
+
+/**
+ * Priorities are not applied on the host, realtime policies need
+ * privileges and the numbers do not map onto FreeRTOS ones anyway.
+ */
+bool Topology::create(Task& t) {
+	HostTask* h = new HostTask();
+	h->size = t.spec.stack < (size_t)PTHREAD_STACK_MIN ? (size_t)PTHREAD_STACK_MIN : t.spec.stack;
+	h->stack = new uint8_t[h->size];
+	h->fn = t.spec.fn;
+	h->arg = t.spec.arg;
+	memset(h->stack, STACK_FILL, h->size);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, h->stack, h->size);
+	if (t.spec.core >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(t.spec.core, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+	int rc = pthread_create(&h->thread, &attr, hostEntry, h);
+	pthread_attr_destroy(&attr);
+	if (rc) {
+		delete [] h->stack;
+		delete h;
+		return false;
+	}
+	pthread_setname_np(h->thread, t.spec.name);
+	t.handle = h;
+	return true;
+}
+
+size_t Topology::stats(TaskStats* out, size_t max) const {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t wall = elapsedUs(s_started, now);
+	size_t n = 0;
+	for (; n < m_len && n < max; n++) {
+		const Task& t = m_tasks[n];
+		const HostTask* h = static_cast<const HostTask*>(t.handle);
+		clockid_t cid;
+		struct timespec cpu = {0, 0};
+		if (!pthread_getcpuclockid(h->thread, &cid))
+			clock_gettime(cid, &cpu);
+
+		//Stacks grow down, untouched fill bytes at the bottom are the high-water mark
+		size_t free = 0;
+		while (free < h->size && h->stack[free] == STACK_FILL)
+			free++;
+
+		out[n].name = t.spec.name;
+		out[n].core = t.spec.core;
+		out[n].prio = t.spec.prio;
+		out[n].cpu = cpu.tv_sec * 1000000ULL + cpu.tv_nsec / 1000;
+		out[n].cpu_pct = wall ? out[n].cpu * 100 / wall : 0;
+		out[n].stack_free = free;
+	}
+	return m_len;
+}
+
+TaskThread::TaskThread() {}
+
+TaskThread::~TaskThread() {
+	join();
+}
+
+//Stack size and priority stay the platform's, as for the table's tasks
+bool TaskThread::start(const TaskSpec& spec) {
+	m_thread = std::thread(spec.fn, spec.arg);
+	pthread_setname_np(m_thread.native_handle(), spec.name);
+	if (spec.core >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(spec.core, &set);
+		pthread_setaffinity_np(m_thread.native_handle(), sizeof(set), &set);
+	}
+	return true;
+}
+
+void TaskThread::join() {
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+bool TaskThread::joinable() const {
+	return m_thread.joinable();
+}
+
+#endif
+
+void Topology::report() const {
+	TaskStats st[TASK_MAX * 2];
+	size_t total = stats(st, tpl::countof(st));
+	size_t n = total < tpl::countof(st) ? total : tpl::countof(st);
+	printf("%-16s %4s %4s %12s %4s %6s\n", "task", "core", "prio", "cpu", "%", "stack");
+	for (size_t i = 0; i < n; i++) {
+		printf("%-16s %4d %4u %12llu %4u %6u\n", st[i].name, st[i].core, st[i].prio,
+				(unsigned long long)st[i].cpu, st[i].cpu_pct, (unsigned)st[i].stack_free);
+	}
+	if (n < total)
+		printf("(%u more)\n", (unsigned)(total - n));
+}
+
+}
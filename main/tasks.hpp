@@ -0,0 +1,117 @@
+/*
+ * tasks.hpp
+ *
+ *  Task topology: every firmware task is declared once with its core,
+ *  priority and stack size, and created pinned accordingly.
+ */
+
+#ifndef MAIN_TASKS_HPP_
+#define MAIN_TASKS_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "templates.hpp"
+
+#ifdef ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#else
+#include <thread>
+#endif
+
+namespace ecuspy {
+
+constexpr int TASK_ANY_CORE = -1;
+constexpr size_t TASK_MAX = 12;
+
+struct TaskSpec {
+	const char* name;
+	void (*fn)(void*);
+	void* arg;
+	int core;
+	unsigned prio;
+	size_t stack;
+};
+
+struct TaskStats {
+	const char* name;
+	int core;
+	unsigned prio;
+	/**
+	 * CPU time in the backend's run time counter units and as share of the
+	 * total since boot, 0 when run time stats are not compiled in.
+	 */
+	uint64_t cpu;
+	unsigned cpu_pct;
+	size_t stack_free;
+};
+
+class Topology : public tpl::Singleton<Topology> {
+public:
+	/**
+	 * Create every task of the table.
+	 * Returns the number of tasks that could not be created.
+	 */
+	size_t start(const TaskSpec* specs, size_t len);
+
+	/**
+	 * Fill out with per-task CPU time and stack high-water marks.
+	 * The ESP32 backend reports every task in the system, the host
+	 * backend the tasks started here. Returns the number of tasks, which
+	 * is more than max when out could not take all of them.
+	 */
+	size_t stats(TaskStats* out, size_t max) const;
+
+	void report() const;
+
+private:
+	friend class Singleton<Topology>;
+
+	Topology() : m_len(0) {}
+
+	struct Task {
+		TaskSpec spec;
+		void* handle;
+	};
+
+	bool create(Task& t);
+
+	Task m_tasks[TASK_MAX];
+	size_t m_len;
+};
+
+/**
+ * A task that only lives as long as some job, e.g. the OTA writer, and is
+ * waited for with join(). It is created from a TaskSpec like the table's
+ * tasks, but not listed in the Topology.
+ */
+class TaskThread {
+public:
+	TaskThread();
+	~TaskThread();
+
+	bool start(const TaskSpec& spec);
+
+	/**
+	 * Wait until the task's function returned.
+	 */
+	void join();
+
+	bool joinable() const;
+
+private:
+#ifdef ESP32
+	static void entry(void* arg);
+
+	void (*m_fn)(void*);
+	void* m_arg;
+	SemaphoreHandle_t m_done;
+#else
+	std::thread m_thread;
+#endif
+};
+
+}
+
+#endif /* MAIN_TASKS_HPP_ */
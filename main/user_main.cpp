@@ -26,8 +26,15 @@ extern "C" {
 #include "libesphttpd/webpages-espfs.h"
 #include "libesphttpd/cgiwebsocket.h"
 #include "cgi-test.h"
+#include "cgi-config.h"
+#include "cgi-tasks.h"
+#include "cgi-ota.h"
+#include "cgi-router.h"
+#include "cgi-tplc.h"
+#include "cgi-dtc.h"
+#include "cgi-adapters.h"
+#include "cgi-query.h"
 }
-#include <iostream>
 #include "templates.hpp"
 #include "esp_wifi.h"
 
@@ -48,6 +55,17 @@ extern "C" {
 #endif
 
 #include "config.hpp"
+#include "rpc.hpp"
+#include "tasks.hpp"
+#include "samples.hpp"
+#include "rules.hpp"
+#include "dlog.hpp"
+#include "simadapter.hpp"
+#include "dtc.hpp"
+#include "session.hpp"
+#include "merge.hpp"
+#include "samplelog.hpp"
+#include "clock.hpp"
 
 #define TAG "user_main"
 
@@ -69,43 +87,28 @@ int myPassFn(HttpdConnData *connData, int no, char *user, int userLen, char *pas
 }
 
 
-//Broadcast the uptime in seconds every second over connected websockets
+//Push the uptime and the windowed PID statistics every second to subscribed RPC sessions
 static void websocketBcast(void *arg) {
 	static int ctr=0;
 	char buff[128];
+	ecuspy::PeriodicTimer tick{"wsbcast", 1000000};
 	while(1) {
-		ctr++;
+		ctr+=tick.wait();
 		sprintf(buff, "Up for %d minutes %d seconds!\n", ctr/60, ctr%60);
-		cgiWebsockBroadcast("/websocket/ws.cgi", buff, strlen(buff), WEBSOCK_FLAG_NONE);
-		vTaskDelay(1000/portTICK_RATE_MS);
+		ecuspy::rpcPublish(ecuspy::rpcChStatus, buff, strlen(buff));
+		ecuspy::samplePublishAggregates(ecuspy::sampleClockMs());
 	}
 }
 
-//On reception of a message, send "You sent: " plus whatever the other side sent
-static void myWebsocketRecv(Websock *ws, char *data, int len, int flags) {
-	int i;
-	char buff[128];
-	sprintf(buff, "You sent: ");
-	for (i=0; i<len; i++) buff[i+10]=data[i];
-	buff[i+10]=0;
-	cgiWebsocketSend(ws, buff, strlen(buff), WEBSOCK_FLAG_NONE);
-}
-
-//Websocket connected. Install reception handler and send welcome message.
-static void myWebsocketConnect(Websock *ws) {
-	ws->recvCb=myWebsocketRecv;
-	cgiWebsocketSend(ws, "Hi, Websocket!", 14, WEBSOCK_FLAG_NONE);
-}
-
 //On reception of a message, echo it back verbatim
 void myEchoWebsocketRecv(Websock *ws, char *data, int len, int flags) {
-	printf("EchoWs: echo, len=%d\n", len);
+	DLOG_D("EchoWs: echo, len=%d", len);
 	cgiWebsocketSend(ws, data, len, flags);
 }
 
 //Echo websocket connected. Install reception handler.
 void myEchoWebsocketConnect(Websock *ws) {
-	printf("EchoWs: connect\n");
+	DLOG_I("EchoWs: connect");
 	ws->recvCb=myEchoWebsocketRecv;
 }
 
@@ -130,17 +133,31 @@ everything before the asterisks; "*" matches everything. The list will be
 handled top-down, so make sure to put more specific rules above the more
 general ones. Authorization things (like authBasic) act as a 'barrier' and
 should be placed above the URLs they protect.
+The table is compiled into a trie by routerInit, httpd itself only sees builtInUrls.
 */
-HttpdBuiltInUrl builtInUrls[]={
+HttpdBuiltInUrl appUrls[]={
 	ROUTE_REDIRECT("/", "/index.html"),
-	//ROUTE_CGI("/config.json", cgiGetConfigJson),
+	ROUTE_CGI("/config.json", cgiGetConfigJson),
+	ROUTE_CGI("/config/set.cgi", cgiSetConfig),
+	ROUTE_CGI("/config.cbor", cgiConfigCbor),
+	ROUTE_CGI("/tasks.json", cgiTaskStats),
+	ROUTE_CGI("/timers.json", cgiTimerStats),
+	ROUTE_CGI("/dtc.json", cgiDtcJson),
+	ROUTE_CGI("/adapters.json", cgiAdapterStats),
+	ROUTE_CGI("/query.cgi", cgiQuery),
+	ROUTE_CGI("/ota/upload.cgi", cgiOtaUpload),
+	ROUTE_CGI("/ota/reboot.cgi", cgiOtaReboot),
+	//Precompiled template, html/led.tpl
+	ROUTE_CGI("/led.tpl", cgiTplc),
+	ROUTE_CGI("/led.cgi", cgiLed),
+	ROUTE_WS("/websocket/ws.cgi", ecuspy::rpcWebsocketConnect),
+	//Throughput testbed, driven by tools/httpbench.c
+	ROUTE_CGI("/test/test.cgi", cgiTestbed),
 #if 0
 	ROUTE_CGI_ARG("*", cgiRedirectApClientToHostname, "esp8266.nonet"),
 	ROUTE_REDIRECT("/", "/index.tpl"),
 
-	ROUTE_TPL("/led.tpl", tplLed),
-	ROUTE_TPL("/index.tpl", tplCounter),
-	ROUTE_CGI("/led.cgi", cgiLed),
+	ROUTE_CGI("/index.tpl", cgiTplc),
 
 	ROUTE_REDIRECT("/flash", "/flash/index.html"),
 	ROUTE_REDIRECT("/flash/", "/flash/index.html"),
@@ -161,7 +178,6 @@ HttpdBuiltInUrl builtInUrls[]={
 	ROUTE_CGI("/wifi/setmode.cgi", cgiWiFiSetMode),
 
 	ROUTE_REDIRECT("/websocket", "/websocket/index.html"),
-	ROUTE_WS("/websocket/ws.cgi", myWebsocketConnect),
 	ROUTE_WS("/websocket/echo.cgi", myEchoWebsocketConnect),
 
 	ROUTE_REDIRECT("/test", "/test/index.html"),
@@ -173,6 +189,11 @@ HttpdBuiltInUrl builtInUrls[]={
 	ROUTE_END()
 };
 
+HttpdBuiltInUrl builtInUrls[]={
+	ROUTE_CGI("*", cgiRouter),
+	ROUTE_END()
+};
+
 
 #ifdef ESP32
 
@@ -288,7 +309,41 @@ const ConfigEntry Cfg3[] = {
 		NumEntry<uint8_t>{"id3", "name3Int", "desc3", cfgCatWIFI, cfgTypeInt8, 3, 0, 200},
 		NumEntry<double>{"id4", "name4Double", "desc4", cfgCatWIFI, cfgTypeDouble, 10, 0.0, 10.1},
 		CustomValidatorEntry{"id5", "name5Double", "desc5", cfgCatWIFI, 15,
-			[](const ConfigEntry& e, const char* str) {return !strcmp(str, "kuku");}}};
+			[](const ConfigEntry& e, const char* str) {return !strcmp(str, "kuku");}},
+		CustomValidatorEntry{"rule1", "Rule 1", "Alert rule, e.g. coolant>110 for 5000 then push",
+			cfgCatAlerts, RULE_LEN, ruleCheck},
+		CustomValidatorEntry{"rule2", "Rule 2", "Alert rule", cfgCatAlerts, RULE_LEN, ruleCheck},
+		CustomValidatorEntry{"rule3", "Rule 3", "Alert rule", cfgCatAlerts, RULE_LEN, ruleCheck},
+		CustomValidatorEntry{"rule4", "Rule 4", "Alert rule", cfgCatAlerts, RULE_LEN, ruleCheck}};
+
+/*
+There is no ELM327 transport yet, so without CONFIG_ECUSPY_SIMULATOR (menuconfig, ECUSpy32)
+no adapter session or DTC task runs. The simulator serves made-up data and is for development only.
+*/
+#ifdef CONFIG_ECUSPY_SIMULATOR
+SimAdapter simAdapter{"sim", 50000};
+
+//PID 01 feeds the MIL status to the DTC cache, the rest become samples
+const uint8_t enginePids[] = {0x01, 0x0C, 0x0D, 0x05, 0x0C, 0x0D, 0x11, 0x0C, 0x0D, 0x04};
+
+//One session per adapter, the index is the sample source; a request every 100 ms
+AdapterSession obd0{0, simAdapter, enginePids, tpl::countof(enginePids), 100000};
+AdapterSession* const Sessions[] = {&obd0};
+#endif
+
+/*
+Every task the firmware starts itself. The network stack (Wi-Fi, lwIP, httpd) runs on
+core 0, so core 1 is kept for acquisition and everything web-facing stays on core 0.
+*/
+const TaskSpec Tasks[] = {
+		{"wsbcast", websocketBcast, NULL, 0, 3, 4096},
+		{"dlog", dlogTask, NULL, TASK_ANY_CORE, 1, 3072},
+		{"samplelog", sampleLogTask, NULL, TASK_ANY_CORE, 2, 3072},
+#ifdef CONFIG_ECUSPY_SIMULATOR
+		{"obd0", sessionTask, &obd0, 1, 5, 4096},
+		{"dtc", dtcTask, static_cast<ObdAdapter*>(&obd0), TASK_ANY_CORE, 2, 4096},
+#endif
+};
 
 //Main routine. Initialize stdout, the I/O, filesystem and the webserver and we're done.
 
@@ -298,18 +353,18 @@ void CfgTest() {
 	Config::instance().setValueStr(0, "abcd");
 	Config::instance().setValueStr(1, "1234");
 	int rc = getConfig<int>("id2");
-	std::cout << "RC=" << rc << std::endl;
+	DLOG_I("RC=%d", rc);
 	{
 		Transaction tr;
 		Config::instance().setValueStr(0, "efgh");
 		Config::instance().setValueStr(1, "4321");
 		rc = getConfig<int>("id2");
-		std::cout << "RC2=" << rc << std::endl;
+		DLOG_I("RC2=%d", rc);
 	}
 	rc = getConfig<int>("id2");
-	std::cout << "RC3=" << rc << std::endl;
+	DLOG_I("RC3=%d", rc);
 	} catch(std::exception& e) {
-		std::cout << "Settings set exception" << std::endl;
+		DLOG_E("Settings set exception");
 	}
 }
 
@@ -318,22 +373,36 @@ extern "C" void app_main(void) {
 	try {
 		throw int(20);
 	} catch(int e) {
-		std::cout << "Caught " << e << std::endl;
+		DLOG_I("Caught %d", e);
 	}
 
 	ioInit();
 
 	CfgTest();
+	rpcInit();
+	RuleEngine::instance().start();
+	SampleLog::instance().start(logStore());
+	SampleMerger::instance().setSink([](const Sample& s, void*) {samplePublish(s);}, nullptr);
+#ifdef CONFIG_ECUSPY_SIMULATOR
+	simAdapter.addEcu(0x7E8);
+	simAdapter.setPid(0x7E8, 0x05, 90);
+	simAdapter.setPid(0x7E8, 0x0C, 800);
+	simAdapter.setPid(0x7E8, 0x0D, 50, 30, 60000);
+	simAdapter.setPid(0x7E8, 0x11, 20, 15, 10000);
+	simAdapter.setPid(0x7E8, 0x04, 35, 20, 10000);
+	sessionRegister(Sessions, tpl::countof(Sessions));
+#endif
 	//LocalConfig.get<int>(0);
 
 	espFsInit((void*)(webpages_espfs_start));
 
 	tcpip_adapter_init();
+	routerInit(appUrls);
 	httpdInit(builtInUrls, 80, HTTPD_FLAG_NONE);
 
 	init_wifi(false); // Supply false for STA mode
 
-	xTaskCreate(websocketBcast, "wsbcast", 3000, NULL, 3, NULL);
+	Topology::instance().start(Tasks, tpl::countof(Tasks));
 
 	printf("\nReady\n");
 }
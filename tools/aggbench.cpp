@@ -0,0 +1,99 @@
+/*
+ * aggbench.cpp
+ *
+ * Update cost per sample of the window aggregation (main/aggregate.hpp)
+ * and the websocket bandwidth of aggregate pushes against raw streaming.
+ * First checks that every window holds its whole duration of samples at
+ * 10 and 100 Hz, less at most the one bucket it rounds off.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o aggbench tools/aggbench.cpp \
+ *            main/aggregate.cpp main/obd.cpp -lpthread
+ * Usage: aggbench [samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "aggregate.hpp"
+#include "obd.hpp"
+
+using namespace ecuspy;
+
+//websocket header + RPC frame header + payload, see rpc.hpp
+constexpr size_t RAW_BYTES = 2 + 5 + 10;
+constexpr size_t AGG_BYTES = 1 + AGG_WINDOWS * (2 + 6 * 4);
+
+namespace {
+
+//Snapshots at odd times over two minutes of samples at rate Hz
+bool checkCounts(unsigned rate) {
+	static PidWindows pw;
+	pw.reset(0x0C, 0, 16383.75f);
+	uint32_t step = 1000 / rate;
+	bool ok = true;
+	for (uint32_t ts = 1; ts <= 120000; ts += step) {
+		pw.add(ts, ts % 7000);
+		if (ts < 60000 || ts % 997 >= step)
+			continue;
+		for (size_t w = 0; w < AGG_WINDOWS; w++) {
+			WindowStats st = pw.stats(w);
+			unsigned full = rate * AGG_WINDOW_MS[w] / 1000;
+			if (st.count > full || st.count < full - full / AGG_SLOTS) {
+				printf("%uHz %us window at %u ms: count=%u, expected %u less at most %u\n", rate,
+						(unsigned)AGG_WINDOW_MS[w] / 1000, (unsigned)ts, st.count, full, full / (unsigned)AGG_SLOTS);
+				ok = false;
+			}
+		}
+	}
+	WindowStats st = pw.stats(AGG_WINDOWS - 1);
+	printf("%3uHz: counts %u/%u/%u, 60s min=%.0f max=%.0f\n", rate, pw.stats(0).count, pw.stats(1).count,
+			st.count, st.min, st.max);
+	return ok;
+}
+
+}
+
+int main(int argc, char** argv) {
+	long samples = argc > 1 ? atol(argv[1]) : 2000000;
+	const uint8_t pids[] = {0x04, 0x05, 0x0B, 0x0C, 0x0D, 0x0F, 0x10, 0x11};
+	Aggregator& agg = Aggregator::instance();
+	float value[8];
+	uint32_t ts = 0;
+
+	if (!checkCounts(10) || !checkCounts(100))
+		return 1;
+
+	for (size_t p = 0; p < 8; p++)
+		value[p] = (pidInfo(pids[p])->lo + pidInfo(pids[p])->hi) / 2;
+
+	srand(1);
+	auto t = std::chrono::steady_clock::now();
+	for (long i = 0; i < samples; i++) {
+		size_t p = i % 8;
+		//Random walk within the PID's range, 100 samples/s per PID
+		const PidInfo* info = pidInfo(pids[p]);
+		value[p] += (rand() % 201 - 100) / 50.0f;
+		value[p] = value[p] < info->lo ? info->lo : value[p] > info->hi ? info->hi : value[p];
+		if (p == 0)
+			ts += 10;
+		agg.add(pids[p], ts, value[p]);
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count();
+
+	uint8_t out[AGG_MAX_PIDS];
+	WindowStats st[AGG_MAX_PIDS * AGG_WINDOWS];
+	size_t n = agg.snapshot(ts, out, st, AGG_MAX_PIDS);
+
+	printf("update: %.1f ns/sample over %ld samples, %zu PIDs\n", ns / samples, samples, n);
+	printf("pid 0x%02x 60s: count=%u min=%.2f max=%.2f mean=%.2f p50=%.2f p99=%.2f\n", out[0],
+			st[2].count, st[2].min, st[2].max, st[2].mean, st[2].p50, st[2].p99);
+	printf("%8s %14s %14s %8s\n", "rate/pid", "raw B/s", "agg B/s", "saved");
+	const int rates[] = {1, 5, 10, 50, 100};
+	for (int r : rates) {
+		double raw = (double)r * RAW_BYTES * n;
+		double agg = (double)(2 + 5 + AGG_BYTES) * n;
+		printf("%6dHz %14.0f %14.0f %7.1f%%\n", r, raw, agg, 100.0 * (1 - agg / raw));
+	}
+	return 0;
+}
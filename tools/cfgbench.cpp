@@ -0,0 +1,184 @@
+/*
+ * cfgbench.cpp
+ *
+ * Round-trip size and parse time of the CBOR config document
+ * (main/cfgcbor.hpp) against the /config.json text form of the same store.
+ * First checks that a store with unset entries survives the round trip
+ * when exported in small pieces.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o cfgbench tools/cfgbench.cpp \
+ *            main/config.cpp main/cfgcbor.cpp -lpthread
+ * Usage: cfgbench [iterations]
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "cfgcbor.hpp"
+
+using namespace ecuspy;
+
+namespace {
+
+std::vector<ConfigEntry> makeTable() {
+	static char ids[48][16];
+	std::vector<ConfigEntry> t;
+	for (int i = 0; i < 48; i++) {
+		snprintf(ids[i], sizeof(ids[i]), "entry%02d", i);
+		switch (i % 4) {
+		case 0: t.push_back(ConfigEntry{ids[i], "", "", cfgCatWIFI, cfgTypeString, 32}); break;
+		case 1: t.push_back(NumEntry<int32_t>{ids[i], "", "", cfgCatELM327, cfgTypeInt32, 11, -100000, 100000}); break;
+		case 2: t.push_back(NumEntry<double>{ids[i], "", "", cfgCatELM327, cfgTypeDouble, 16, 0.0, 1000.0}); break;
+		default: t.push_back(ConfigEntry{ids[i], "", "", cfgCatSystem, cfgTypeBOOL, 5}); break;
+		}
+	}
+	return t;
+}
+
+std::string value(int i) {
+	char buff[32];
+	switch (i % 4) {
+	case 0: snprintf(buff, sizeof(buff), "network-%d", i * 7919); break;
+	case 1: snprintf(buff, sizeof(buff), "%d", i * 1237 - 20000); break;
+	case 2: snprintf(buff, sizeof(buff), "%.3f", i * 13.37); break;
+	default: snprintf(buff, sizeof(buff), "%s", i & 1 ? "true" : "false"); break;
+	}
+	return buff;
+}
+
+//Same output as cgiGetConfigJson
+std::string jsonExport() {
+	Config& cfg = Config::instance();
+	std::string out = "{";
+	for (size_t i = 0; i < cfg.size(); i++) {
+		if (i)
+			out += ",";
+		out += "\"";
+		out += cfg.entry(i).id;
+		out += "\":\"";
+		out += cfg.getValueStr(i);
+		out += "\"";
+	}
+	return out + "}";
+}
+
+//The least a device-side JSON import has to do: split pairs, look up ids, validate
+size_t jsonParse(const std::string& doc) {
+	Config& cfg = Config::instance();
+	char id[64], val[64];
+	size_t n = 0;
+	const char* p = doc.c_str();
+	while ((p = strchr(p, '"'))) {
+		const char* e = strchr(p + 1, '"');
+		size_t l = e - p - 1;
+		memcpy(id, p + 1, l);
+		id[l] = 0;
+		p = strchr(e + 1, '"');
+		e = strchr(p + 1, '"');
+		l = e - p - 1;
+		memcpy(val, p + 1, l);
+		val[l] = 0;
+		p = e + 1;
+		size_t index = cfg.indexByID(id);
+		if (index != BADINDEX && cfg.validate(index, val))
+			n++;
+	}
+	return n;
+}
+
+//Every third entry left unset, exported 48 bytes at a time, imported over a fully set store
+bool roundTrip(size_t entries) {
+	Config& cfg = Config::instance();
+	for (size_t i = 0; i < entries; i++)
+		cfg.setValueStr(i, i % 3 ? value(i).c_str() : "");
+
+	uint8_t doc[4096];
+	size_t len = 0, l;
+	CborExporter ex;
+	while (!ex.done()) {
+		if (!(l = ex.next(doc + len, 48))) {
+			printf("CBOR export stuck at %zu bytes\n", len);
+			return false;
+		}
+		len += l;
+	}
+
+	for (size_t i = 0; i < entries; i++)
+		cfg.setValueStr(i, value(i).c_str());
+	CborImporter im;
+	CborStatus_t rc = im.feed(doc, len);
+	if (rc != cborDone || !im.commit()) {
+		printf("CBOR import failed, rc=%d\n", rc);
+		return false;
+	}
+	for (size_t i = 0; i < entries; i++) {
+		std::string expect = i % 3 ? value(i) : "";
+		if (expect != cfg.getValueStr(i)) {
+			printf("CBOR round trip: %s is \"%s\", expected \"%s\"\n", cfg.entry(i).id,
+					cfg.getValueStr(i), expect.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+double usSince(std::chrono::steady_clock::time_point t) {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count();
+}
+
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+	static std::vector<ConfigEntry> table = makeTable();
+	Config& cfg = Config::instance();
+	cfg.initialize(table.data(), table.size());
+	if (!roundTrip(table.size()))
+		return 1;
+	printf("round trip with unset entries ok\n");
+	for (size_t i = 0; i < table.size(); i++)
+		cfg.setValueStr(i, value(i).c_str());
+
+	uint8_t doc[4096];
+	size_t cborLen = 0;
+	auto t = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		CborExporter ex;
+		size_t l;
+		cborLen = 0;
+		while (!ex.done() && (l = ex.next(doc + cborLen, sizeof(doc) - cborLen)))
+			cborLen += l;
+	}
+	double cborOut = usSince(t) / iterations;
+
+	size_t entries = 0;
+	t = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		CborImporter im;
+		if (im.feed(doc, cborLen) != cborDone) {
+			printf("CBOR round trip failed\n");
+			return 1;
+		}
+		entries = im.entries();
+	}
+	double cborIn = usSince(t) / iterations;
+
+	std::string json;
+	t = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		json = jsonExport();
+	double jsonOut = usSince(t) / iterations;
+
+	size_t jsonEntries = 0;
+	t = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		jsonEntries = jsonParse(json);
+	double jsonIn = usSince(t) / iterations;
+
+	printf("entries=%zu\n", table.size());
+	printf("cbor  bytes=%5zu export=%7.2fus parse=%7.2fus (%zu valid)\n", cborLen, cborOut, cborIn, entries);
+	printf("json  bytes=%5zu export=%7.2fus parse=%7.2fus (%zu valid)\n", json.size(), jsonOut, jsonIn, jsonEntries);
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * dlogbench.cpp
+ *
+ * Cost per log call at the call site: deferred DLOG_I (main/dlog.hpp)
+ * against printf to a file and snprintf alone, plus the formatter's cost
+ * per record when it drains the rings.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o dlogbench tools/dlogbench.cpp \
+ *            main/dlog.cpp -lpthread
+ * Usage: dlogbench [iterations]
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dlog.hpp"
+
+using namespace ecuspy;
+
+namespace {
+
+double nsSince(std::chrono::steady_clock::time_point t, int n) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count() / n;
+}
+
+void nullSink(const DlogRecord& r, void* arg) {
+	char buff[160];
+	*(size_t*)arg += dlogFormat(r, buff, sizeof(buff));
+}
+
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+	FILE* null = fopen("/dev/null", "w");
+	char buff[160];
+	size_t chars = 0;
+	double dlog = 0, drain = 0;
+
+	//Log in bursts the ring can hold, drain between bursts outside the timing
+	for (int done = 0; done < iterations; done += DLOG_RING) {
+		auto t = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < DLOG_RING; i++)
+			DLOG_I("EchoWs: echo, len=%d pid %02x=%.2f", (int)i, 0x05, i * 0.5);
+		dlog += nsSince(t, 1);
+		t = std::chrono::steady_clock::now();
+		dlogDrain(nullSink, &chars);
+		drain += nsSince(t, 1);
+	}
+	int logged = (iterations + DLOG_RING - 1) / DLOG_RING * DLOG_RING;
+
+	auto t = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		fprintf(null, "EchoWs: echo, len=%d pid %02x=%.2f\n", i, 0x05, i * 0.5);
+	double fpr = nsSince(t, iterations);
+
+	t = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		chars += snprintf(buff, sizeof(buff), "EchoWs: echo, len=%d pid %02x=%.2f\n", i, 0x05, i * 0.5);
+	double spr = nsSince(t, iterations);
+
+	t = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		DLOG_D("EchoWs: echo, len=%d", i);
+	double off = nsSince(t, iterations);
+
+	printf("calls=%d dropped=%u (%zu chars)\n", iterations, (unsigned)dlogDropped(), chars);
+	printf("DLOG_I call      %7.1f ns\n", dlog / logged);
+	printf("DLOG_D compiled  %7.1f ns\n", off);
+	printf("fprintf          %7.1f ns\n", fpr);
+	printf("snprintf         %7.1f ns\n", spr);
+	printf("deferred format  %7.1f ns per record\n", drain / logged);
+	fclose(null);
+	return 0;
+}
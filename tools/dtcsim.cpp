@@ -0,0 +1,135 @@
+/*
+ * dtcsim.cpp
+ *
+ * Host driver for the DTC cache (main/dtc.hpp) against a simulated adapter
+ * with two ECUs. An acquisition thread reports the MIL status like the
+ * firmware's polling would; the driver turns the MIL on and off and checks
+ * that page loads, i.e. cache reads, cause no bus traffic while refreshes
+ * happen only on MIL changes.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o dtcsim tools/dtcsim.cpp main/dtc.cpp \
+ *            main/simadapter.cpp main/obd.cpp main/clock.cpp -lpthread
+ * Usage: dtcsim [latency_us]
+ */
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+
+#include "dtc.hpp"
+#include "simadapter.hpp"
+#include "clock.hpp"
+
+using namespace ecuspy;
+
+namespace {
+
+std::atomic<bool> s_stop{false};
+std::atomic<uint32_t> s_acq{0};
+
+//Stands in for acquisition: polls 01 01 and reports it to the cache
+void acquisition(SimAdapter* adapter) {
+	ObdResponse resp[OBD_MAX_ECUS];
+	const uint8_t pid = 0x01;
+	while (!s_stop) {
+		int n = adapter->request(0x01, &pid, 1, resp, OBD_MAX_ECUS);
+		s_acq++;
+		for (int i = 0; i < n; i++)
+			DtcCache::instance().milStatus(resp[i].ecu, resp[i].data[1]);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
+
+uint32_t busRequests(SimAdapter& a) {
+	return a.requests() - s_acq;
+}
+
+//Waits for the cache version to move past v, returns the time it took
+uint32_t waitVersion(uint32_t v) {
+	uint32_t t = clockMs();
+	while (DtcCache::instance().version() == v)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return clockMs() - t;
+}
+
+void print(const DtcSnapshot& s) {
+	char code[6];
+	printf("  version %u, %zu ECUs\n", (unsigned)s.version, s.ecus);
+	for (size_t i = 0; i < s.ecus; i++) {
+		const EcuDtcs& e = s.ecu[i];
+		printf("  %03X mil=%d stored:", e.ecu, e.mil);
+		for (size_t c = 0; c < e.count[dtcStored]; c++) {
+			dtcFormat(e.codes[dtcStored][c], code);
+			printf(" %s", code);
+		}
+		printf(" pending:%u", e.count[dtcPending]);
+		if (e.has_frame) {
+			dtcFormat(e.frame.dtc, code);
+			printf(" frame %s with %u PIDs", code, e.frame.pids);
+		}
+		printf("\n");
+	}
+}
+
+}
+
+int main(int argc, char** argv) {
+	uint32_t latency = argc > 1 ? atoi(argv[1]) : 20000;
+	SimAdapter sim("sim", latency);
+	sim.addEcu(0x7E8);
+	sim.addEcu(0x7E9);
+	sim.setPid(0x7E8, 0x05, 92);
+	sim.setPid(0x7E8, 0x0C, 780);
+	sim.setPid(0x7E8, 0x0D, 0);
+	sim.setPid(0x7E9, 0x0D, 0);
+
+	DtcCache& cache = DtcCache::instance();
+	std::thread refresher([&sim] {DtcCache::instance().run(sim);});
+	std::thread acq(acquisition, &sim);
+	DtcSnapshot snap;
+
+	uint32_t ms = waitVersion(0);
+	uint32_t before = busRequests(sim);
+	printf("initial refresh after %u ms, %u requests\n", (unsigned)ms, (unsigned)before);
+
+	for (int i = 0; i < 1000; i++)
+		cache.snapshot(snap);
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	printf("1000 page loads: %u bus requests\n", (unsigned)(busRequests(sim) - before));
+	print(snap);
+
+	const uint16_t stored[] = {0x0301, 0x0171};
+	const uint16_t pending[] = {0x0420};
+	uint32_t v = cache.version();
+	before = busRequests(sim);
+	sim.setDtcs(0x7E8, 0x03, stored, 2);
+	sim.setDtcs(0x7E8, 0x07, pending, 1);
+	sim.setMil(0x7E8, true);
+	ms = waitVersion(v);
+	cache.snapshot(snap);
+	printf("MIL on: new version after %u ms, %u requests\n", (unsigned)ms, (unsigned)(busRequests(sim) - before));
+	print(snap);
+
+	before = busRequests(sim);
+	for (int i = 0; i < 1000; i++)
+		cache.snapshot(snap);
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	printf("1000 page loads: %u bus requests\n", (unsigned)(busRequests(sim) - before));
+
+	v = cache.version();
+	before = busRequests(sim);
+	sim.setDtcs(0x7E8, 0x03, nullptr, 0);
+	sim.setDtcs(0x7E8, 0x07, nullptr, 0);
+	sim.setMil(0x7E8, false);
+	ms = waitVersion(v);
+	cache.snapshot(snap);
+	printf("MIL off: new version after %u ms, %u requests\n", (unsigned)ms, (unsigned)(busRequests(sim) - before));
+	print(snap);
+
+	s_stop = true;
+	acq.join();
+	//The refresher never returns, leave without tearing down the cache under it
+	fflush(stdout);
+	std::quick_exit(0);
+}
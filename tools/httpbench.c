@@ -0,0 +1,222 @@
+/*
+ * httpbench.c
+ *
+ * Host-side load generator for the /test/test.cgi testbed (main/cgi-test.c).
+ * Opens N concurrent connections against the device and reports requests/s,
+ * MB/s and p50/p99 latency for GET downloads, POST uploads or a mix of small
+ * requests.
+ *
+ * Build: gcc -O2 -o httpbench tools/httpbench.c -lpthread
+ * Usage: httpbench [-h host] [-p port] [-c conns] [-d seconds]
+ *                  [-m get|post|mix] [-s size] [-k chunk]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_CONNS 64
+#define MAX_SAMPLES (1<<16)
+#define SMALL_SIZE 64
+
+typedef enum {
+	modeGet,
+	modePost,
+	modeMix
+} BenchMode;
+
+typedef struct {
+	int id;
+	long requests;
+	long errors;
+	long long bytes;
+	int nsamples;
+	double *latency;
+} Worker;
+
+static const char *host="192.168.4.1";
+static const char *port="80";
+static int conns=4;
+static int duration=10;
+static int size=64*1024;
+static int chunk=1024;
+static BenchMode mode=modeGet;
+static struct addrinfo *addr;
+static volatile int running=1;
+static char *postBody;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static int sendAll(int fd, const char *buf, int len) {
+	while (len>0) {
+		int n=send(fd, buf, len, 0);
+		if (n<=0) return -1;
+		buf+=n;
+		len-=n;
+	}
+	return 0;
+}
+
+//Runs one request on a fresh connection. Returns received payload+request body size, -1 on error.
+static long long doRequest(int post, int len) {
+	char buf[8192];
+	long long total=0;
+	int hdr, fd, n, status=0, one=1;
+
+	fd=socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+	if (fd<0) return -1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, addr->ai_addr, addr->ai_addrlen)<0) {
+		close(fd);
+		return -1;
+	}
+
+	if (post) {
+		hdr=snprintf(buf, sizeof(buf), "POST /test/test.cgi HTTP/1.0\r\nHost: %s\r\n"
+				"Content-Type: application/octet-stream\r\nContent-Length: %d\r\n\r\n", host, len);
+		if (sendAll(fd, buf, hdr)<0 || sendAll(fd, postBody, len)<0) goto fail;
+		total+=len;
+	} else {
+		hdr=snprintf(buf, sizeof(buf), "GET /test/test.cgi?len=%d&chunk=%d HTTP/1.0\r\nHost: %s\r\n\r\n",
+				len, chunk, host);
+		if (sendAll(fd, buf, hdr)<0) goto fail;
+	}
+
+	//Read until the server closes; the status line tells us whether it worked
+	while ((n=recv(fd, buf, sizeof(buf)-1, 0))>0) {
+		buf[n]=0;
+		if (!status && total==(post?len:0)) sscanf(buf, "HTTP/%*s %d", &status);
+		total+=n;
+	}
+	close(fd);
+	return status==200?total:-1;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+static void *workerTask(void *arg) {
+	Worker *w=(Worker*)arg;
+	long seq=0;
+	while (running) {
+		int post=0, len=size;
+		double t0, t1;
+		long long r;
+
+		if (mode==modePost) post=1;
+		if (mode==modeMix) {
+			post=(seq+w->id)&1;
+			len=SMALL_SIZE;
+		}
+		seq++;
+
+		t0=now();
+		r=doRequest(post, len);
+		t1=now();
+		if (r<0) {
+			w->errors++;
+			continue;
+		}
+		w->requests++;
+		w->bytes+=r;
+		if (w->nsamples<MAX_SAMPLES) w->latency[w->nsamples++]=t1-t0;
+	}
+	return NULL;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+	double x=*(const double*)a, y=*(const double*)b;
+	return (x>y)-(x<y);
+}
+
+static void usage(const char *me) {
+	fprintf(stderr, "Usage: %s [-h host] [-p port] [-c conns] [-d seconds] "
+			"[-m get|post|mix] [-s size] [-k chunk]\n", me);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	Worker workers[MAX_CONNS];
+	pthread_t threads[MAX_CONNS];
+	struct addrinfo hints;
+	long requests=0, errors=0;
+	long long bytes=0;
+	double *all, t0, elapsed;
+	int i, n=0, opt;
+
+	while ((opt=getopt(argc, argv, "h:p:c:d:m:s:k:"))!=-1) {
+		switch (opt) {
+		case 'h': host=optarg; break;
+		case 'p': port=optarg; break;
+		case 'c': conns=atoi(optarg); break;
+		case 'd': duration=atoi(optarg); break;
+		case 's': size=atoi(optarg); break;
+		case 'k': chunk=atoi(optarg); break;
+		case 'm':
+			if (!strcmp(optarg, "get")) mode=modeGet;
+			else if (!strcmp(optarg, "post")) mode=modePost;
+			else if (!strcmp(optarg, "mix")) mode=modeMix;
+			else usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (conns<1 || conns>MAX_CONNS || duration<1 || size<0) usage(argv[0]);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family=AF_UNSPEC;
+	hints.ai_socktype=SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addr)!=0) {
+		fprintf(stderr, "Can't resolve %s:%s\n", host, port);
+		return 1;
+	}
+
+	postBody=malloc(size>SMALL_SIZE?size:SMALL_SIZE);
+	memset(postBody, 'x', size>SMALL_SIZE?size:SMALL_SIZE);
+
+	t0=now();
+	for (i=0; i<conns; i++) {
+		memset(&workers[i], 0, sizeof(Worker));
+		workers[i].id=i;
+		workers[i].latency=malloc(sizeof(double)*MAX_SAMPLES);
+		pthread_create(&threads[i], NULL, workerTask, &workers[i]);
+	}
+	sleep(duration);
+	running=0;
+	for (i=0; i<conns; i++) pthread_join(threads[i], NULL);
+	elapsed=now()-t0;
+
+	for (i=0; i<conns; i++) n+=workers[i].nsamples;
+	all=malloc(sizeof(double)*(n?n:1));
+	n=0;
+	for (i=0; i<conns; i++) {
+		memcpy(all+n, workers[i].latency, sizeof(double)*workers[i].nsamples);
+		n+=workers[i].nsamples;
+		requests+=workers[i].requests;
+		errors+=workers[i].errors;
+		bytes+=workers[i].bytes;
+	}
+	qsort(all, n, sizeof(double), cmpDouble);
+
+	printf("mode=%s conns=%d size=%d chunk=%d time=%.1fs\n",
+			mode==modeGet?"get":mode==modePost?"post":"mix", conns, size, chunk, elapsed);
+	printf("requests=%ld errors=%ld req/s=%.1f MB/s=%.3f\n",
+			requests, errors, requests/elapsed, bytes/elapsed/(1024.0*1024.0));
+	if (n) {
+		printf("latency p50=%.2fms p99=%.2fms max=%.2fms\n",
+				all[n/2]*1000, all[(int)(n*0.99)]*1000, all[n-1]*1000);
+	}
+	return errors && !requests;
+}
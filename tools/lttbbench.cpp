@@ -0,0 +1,240 @@
+/*
+ * lttbbench.cpp
+ *
+ * Host benchmark for chart queries (main/query.hpp) over the sample log
+ * (main/samplelog.hpp). Polls an hour of rpm at 10 Hz, speed at 5 Hz and
+ * coolant at 1 Hz into a file-backed log the size of the samplelog
+ * partition, LOG_DEVICE_SECTORS, through the per PID decimation. Reports
+ * what is kept, how long the log holds and how often a sector is erased,
+ * then runs the queries the way /query.cgi does, 1 KB per call, and
+ * reports time, response size and calls for raw export against LTTB and
+ * min/max downsampling.
+ *
+ * The bounded LTTB keeps a bucket's convex hull, up to QUERY_HULL vertices
+ * per side. For rpm, the chart drawn through its points is compared with
+ * the ones through every logged point, exact LTTB over the same buckets
+ * and min/max, as the mean and largest distance to the polled samples.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o lttbbench tools/lttbbench.cpp main/query.cpp \
+ *            main/samplelog.cpp -lpthread
+ * Usage: lttbbench [points] [minutes]
+ */
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+
+#include "query.hpp"
+#include "samplelog.hpp"
+
+using namespace ecuspy;
+
+namespace {
+
+constexpr uint32_t START = 1000;
+
+struct Result {
+	size_t bytes;
+	size_t calls;
+	uint32_t records;
+	double ms;
+	std::vector<QueryPoint> points;
+};
+
+float drive(uint8_t pid, uint32_t t) {
+	float s = t / 1000.0f;
+	float noise = (rand() % 1000) / 1000.0f - 0.5f;
+	switch (pid) {
+	case 0x0C:
+		return 2000 + 1200 * sinf(s / 40) + 600 * sinf(s / 7) + 80 * noise;
+	case 0x0D:
+		return 60 + 40 * sinf(s / 300) + 5 * sinf(s / 11) + 2 * noise;
+	default:
+		return 90 - 60 * expf(-s / 300) + noise;
+	}
+}
+
+struct Pt {
+	uint32_t ts;
+	float value;
+};
+
+//Every rpm sample polled, before the log reduces it
+std::vector<Pt> s_polled;
+
+void fill(uint32_t minutes) {
+	const uint8_t pids[] = {0x0C, 0x0D, 0x05};
+	const uint32_t period[] = {100, 200, 1000};
+	SampleLog& log = SampleLog::instance();
+	for (uint32_t t = START; t < START + minutes * 60000; t += 100) {
+		for (size_t i = 0; i < 3; i++) {
+			if ((t - START) % period[i])
+				continue;
+			float v = drive(pids[i], t);
+			if (pids[i] == 0x0C)
+				s_polled.push_back(Pt{t, v});
+			log.append(Sample{t, pids[i], 0, v});
+		}
+		log.flush();
+	}
+}
+
+//Sends the way the CGI does, the parsed points are kept for the comparison
+Result run(QueryMode_t mode, uint32_t from, uint32_t to, const uint8_t* pids, size_t len, size_t points) {
+	char buf[1024];
+	Result r{0, 0, 0, 0, {}};
+	auto t0 = std::chrono::steady_clock::now();
+	LogQuery q(mode, from, to, pids, len, points);
+	std::string body;
+	while (!q.done()) {
+		size_t l = q.next(buf, sizeof(buf));
+		r.bytes += l;
+		r.calls++;
+		body.append(buf, l);
+	}
+	r.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	r.records = q.records();
+	for (const char* p = strchr(body.c_str(), '[') + 1; (p = strchr(p, '[')); p++) {
+		unsigned pid, ts;
+		float v;
+		if (sscanf(p, "[%u,%u,%g]", &pid, &ts, &v) == 3)
+			r.points.push_back(QueryPoint{(uint8_t)pid, ts, v});
+	}
+	return r;
+}
+
+//Exact LTTB over the same time buckets as SeriesQuery: first point, one per bucket, last point
+std::vector<Pt> exactLttb(const std::vector<Pt>& pts, uint32_t from, uint32_t to, size_t points) {
+	std::vector<Pt> out;
+	size_t nb = points - 2;
+	auto bucket = [&](uint32_t ts) {
+		uint64_t b = (uint64_t)(ts - from) * nb / (to - from);
+		return b < nb ? b : nb - 1;
+	};
+	std::vector<std::vector<Pt>> buckets;
+	std::vector<uint64_t> index;
+	for (size_t i = 1; i < pts.size(); i++) {
+		uint64_t b = bucket(pts[i].ts);
+		if (index.empty() || index.back() != b) {
+			index.push_back(b);
+			buckets.emplace_back();
+		}
+		buckets.back().push_back(pts[i]);
+	}
+	out.push_back(pts[0]);
+	Pt a = pts[0];
+	for (size_t i = 0; i < buckets.size(); i++) {
+		Pt c;
+		bool last = i + 1 == buckets.size();
+		if (last) {
+			c = pts.back();
+			if (buckets[i].size() == 1)
+				break;
+		} else {
+			double st = 0, sv = 0;
+			for (const Pt& p : buckets[i + 1]) {
+				st += p.ts;
+				sv += p.value;
+			}
+			c = Pt{(uint32_t)(st / buckets[i + 1].size()), (float)(sv / buckets[i + 1].size())};
+		}
+		double best = -1;
+		Pt sel = buckets[i][0];
+		for (const Pt& p : buckets[i]) {
+			double area = fabs(((double)c.ts - a.ts) * ((double)p.value - a.value) -
+					((double)p.ts - a.ts) * ((double)c.value - a.value));
+			if (area > best) {
+				best = area;
+				sel = p;
+			}
+		}
+		if (!last || sel.ts != pts.back().ts)
+			out.push_back(sel);
+		a = sel;
+	}
+	out.push_back(pts.back());
+	return out;
+}
+
+//How far the chart drawn through the points is off the raw data
+std::string error(const std::vector<Pt>& raw, const std::vector<Pt>& line) {
+	double sum = 0, max = 0;
+	size_t j = 0;
+	for (const Pt& p : raw) {
+		while (j + 2 < line.size() && line[j + 1].ts <= p.ts)
+			j++;
+		const Pt& a = line[j];
+		const Pt& b = line[j + 1];
+		double v = b.ts == a.ts ? a.value : a.value + (b.value - a.value) * ((double)p.ts - a.ts) / ((double)b.ts - a.ts);
+		double e = fabs(v - p.value);
+		sum += e;
+		max = e > max ? e : max;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.0f/%.0f", sum / raw.size(), max);
+	return buf;
+}
+
+void print(const char* name, const Result& r) {
+	printf("%-8s %8.2f ms %9zu bytes %6zu calls %7zu points from %u records\n", name, r.ms, r.bytes, r.calls,
+			r.points.size(), (unsigned)r.records);
+}
+
+}
+
+int main(int argc, char** argv) {
+	size_t points = argc > 1 ? atoi(argv[1]) : 500;
+	uint32_t minutes = argc > 2 ? atoi(argv[2]) : 60;
+	static FileLogStore store("/tmp/lttbbench.log", LOG_DEVICE_SECTORS);
+	SampleLog& log = SampleLog::instance();
+	log.start(store);
+	fill(minutes);
+	//Every sector is erased once per wrap
+	double rate = log.end() / (minutes * 60.0);
+	double holds = store.capacity() / rate / 60;
+	printf("%u of %u samples logged (%.1f/s), %u dropped; %zu sectors hold %.0f min, "
+			"a sector erase every %.0f s, %.0f erases per sector per day\n", (unsigned)log.end(),
+			(unsigned)(minutes * 60 * 16), rate, (unsigned)log.dropped(), store.capacity() / store.sectorRecords(),
+			holds, store.sectorRecords() / rate, 24 * 60 / holds);
+	//Query what the log still holds
+	uint32_t end = START + minutes * 60000;
+	uint32_t kept = minutes < holds ? minutes : (uint32_t)holds;
+
+	const uint8_t all[] = {0x0C, 0x0D, 0x05};
+	const uint32_t ranges[] = {kept * 60000, 10 * 60000};
+	for (uint32_t range : ranges) {
+		if (range > kept * 60000)
+			continue;
+		uint32_t from = end - range, to = end;
+		printf("\n%u min, rpm+speed+coolant, %zu points per PID:\n", (unsigned)(range / 60000), points);
+		print("raw", run(queryRaw, from, to, all, 3, points));
+		print("minmax", run(queryMinMax, from, to, all, 3, points));
+		Result lttb = run(queryLttb, from, to, all, 3, points);
+		print("lttb", lttb);
+
+		Result raw = run(queryRaw, from, to, all, 1, points);
+		std::vector<Pt> rpm;
+		for (const QueryPoint& p : raw.points)
+			rpm.push_back(Pt{p.ts, p.value});
+		std::vector<Pt> bounded, minmax;
+		for (const QueryPoint& p : lttb.points) {
+			if (p.pid == 0x0C)
+				bounded.push_back(Pt{p.ts, p.value});
+		}
+		for (const QueryPoint& p : run(queryMinMax, from, to, all, 1, points).points)
+			minmax.push_back(Pt{p.ts, p.value});
+		std::vector<Pt> polled;
+		for (const Pt& p : s_polled) {
+			if (p.ts >= rpm.front().ts && p.ts <= rpm.back().ts)
+				polled.push_back(p);
+		}
+		printf("rpm chart error, mean/max over the polled samples: logged %s, lttb %s, exact lttb %s, minmax %s\n",
+				error(polled, rpm).c_str(), error(polled, bounded).c_str(),
+				error(polled, exactLttb(rpm, rpm.front().ts, rpm.back().ts + 1, points)).c_str(),
+				error(polled, minmax).c_str());
+	}
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * multisim.cpp
+ *
+ * Host driver for concurrent adapter sessions (main/session.hpp) and the
+ * sample merge (main/merge.hpp). Two simulated adapters with different
+ * round trip times both report rpm as the same sine of the shared clock;
+ * each is polled by its own session thread while the main thread issues
+ * DTC reads through one of them like the DTC cache does.
+ *
+ * The sink checks that the merged stream is in timestamp order and
+ * compares every rpm value to the sine at its timestamp. Midpoint
+ * stamping is set against stamping on completion, which is what a
+ * single polling loop reading the clock after each answer would do.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o multisim tools/multisim.cpp main/session.cpp \
+ *            main/merge.cpp main/simadapter.cpp main/dtc.cpp main/obd.cpp \
+ *            main/clock.cpp -lpthread
+ * Usage: multisim [seconds] [latency0_us] [latency1_us]
+ */
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <cmath>
+#include <cstdlib>
+
+#include "session.hpp"
+#include "merge.hpp"
+#include "simadapter.hpp"
+#include "obd.hpp"
+#include "clock.hpp"
+
+using namespace ecuspy;
+
+namespace {
+
+constexpr float RPM_BASE = 3000;
+constexpr float RPM_AMP = 2000;
+constexpr uint32_t RPM_PERIOD = 20000;
+
+struct SourceStats {
+	uint32_t samples;
+	uint32_t rpm;
+	double err_mid;
+	double err_end;
+	float max_mid;
+};
+
+std::mutex s_lock;
+SourceStats s_src[2];
+uint32_t s_last;
+uint32_t s_total;
+uint32_t s_unordered;
+uint32_t s_latency[2];
+
+float rpmAt(double ms) {
+	return RPM_BASE + RPM_AMP * sinf(2 * (float)M_PI * fmod(ms, RPM_PERIOD) / RPM_PERIOD);
+}
+
+void sink(const Sample& s, void*) {
+	std::lock_guard<std::mutex> guard{s_lock};
+	if (s_total && s.ts < s_last)
+		s_unordered++;
+	s_last = s.ts;
+	s_total++;
+	if (s.source >= 2)
+		return;
+	SourceStats& st = s_src[s.source];
+	st.samples++;
+	if (s.pid != 0x0C)
+		return;
+	//The answer came halfway through the round trip, completion is half of it later
+	float mid = fabsf(s.value - rpmAt(s.ts));
+	st.err_mid += mid;
+	st.err_end += fabsf(s.value - rpmAt(s.ts + s_latency[s.source] / 2000.0));
+	if (mid > st.max_mid)
+		st.max_mid = mid;
+	st.rpm++;
+}
+
+}
+
+int main(int argc, char** argv) {
+	uint32_t seconds = argc > 1 ? atoi(argv[1]) : 10;
+	s_latency[0] = argc > 2 ? atoi(argv[2]) : 30000;
+	s_latency[1] = argc > 3 ? atoi(argv[3]) : 90000;
+
+	SimAdapter can("can", s_latency[0]);
+	SimAdapter kline("kline", s_latency[1]);
+	can.addEcu(0x7E8);
+	can.setPid(0x7E8, 0x0C, RPM_BASE, RPM_AMP, RPM_PERIOD);
+	can.setPid(0x7E8, 0x05, 90);
+	kline.addEcu(0x7E8);
+	kline.setPid(0x7E8, 0x0C, RPM_BASE, RPM_AMP, RPM_PERIOD);
+	kline.setPid(0x7E8, 0x0D, 60, 40, 30000);
+	const uint16_t stored[] = {0x0301};
+	kline.setDtcs(0x7E8, 0x03, stored, 1);
+
+	const uint8_t canPids[] = {0x0C, 0x05};
+	const uint8_t klinePids[] = {0x01, 0x0C, 0x0D};
+	AdapterSession s0{0, can, canPids, tpl::countof(canPids)};
+	AdapterSession s1{1, kline, klinePids, tpl::countof(klinePids)};
+	AdapterSession* const sessions[] = {&s0, &s1};
+	sessionRegister(sessions, tpl::countof(sessions));
+	SampleMerger::instance().setSink(sink, nullptr);
+
+	std::thread t0([&s0] {s0.run();});
+	std::thread t1([&s1] {s1.run();});
+
+	//DTC reads through the K-line session, queued between its polls
+	ObdResponse resp[OBD_MAX_ECUS];
+	uint32_t reads = 0, worst = 0;
+	uint64_t end = clockUs() + seconds * 1000000ULL;
+	while (clockUs() < end) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		uint64_t t = clockUs();
+		if (s1.request(0x03, nullptr, 0, resp, OBD_MAX_ECUS) != 1 || resp[0].data[0] != 1)
+			printf("DTC read failed\n");
+		uint32_t us = clockUs() - t;
+		worst = us > worst ? us : worst;
+		reads++;
+	}
+
+	SessionStats st[2];
+	size_t n = sessionStats(st, 2);
+	std::lock_guard<std::mutex> guard{s_lock};
+	printf("%u merged samples, %u out of order, %u late\n", (unsigned)s_total, (unsigned)s_unordered,
+			(unsigned)SampleMerger::instance().late());
+	for (size_t i = 0; i < n; i++) {
+		const SourceStats& src = s_src[i];
+		printf("%-6s %u req (%u.%02u/s), %u err, avg %u us, max %u us, %u samples merged, %u commands\n",
+				st[i].name, (unsigned)st[i].requests, (unsigned)(st[i].rate / 100), (unsigned)(st[i].rate % 100),
+				(unsigned)st[i].errors, (unsigned)st[i].avg_us, (unsigned)st[i].max_us, (unsigned)src.samples,
+				(unsigned)st[i].commands);
+		if (src.rpm)
+			printf("       rpm error: midpoint avg %.1f max %.1f, on completion avg %.1f\n",
+					src.err_mid / src.rpm, src.max_mid, src.err_end / src.rpm);
+	}
+	printf("%u DTC reads, worst %u us\n", (unsigned)reads, (unsigned)worst);
+	//The sessions never return
+	fflush(stdout);
+	std::quick_exit(0);
+}
@@ -0,0 +1,147 @@
+/*
+ * otabench.cpp
+ *
+ * Update throughput of the pipelined OtaUpdater (main/ota.hpp) against a
+ * serial receive-hash-write loop. The network and the flash are simulated
+ * with a rate each: data arrives in MSS-sized chunks, the file-backed
+ * flash shim sleeps for the time the write would take on the device.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o otabench tools/otabench.cpp \
+ *            main/ota.cpp main/tasks.cpp -lpthread
+ * Usage: otabench [-s image_kb] [-n net_kb_per_s] [-f flash_kb_per_s] [-o file]
+ */
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+
+#include "ota.hpp"
+
+using namespace ecuspy;
+
+namespace {
+
+constexpr size_t MSS = 1436;
+
+void sleepFor(size_t bytes, int kbPerS) {
+	if (kbPerS > 0)
+		std::this_thread::sleep_for(std::chrono::microseconds(bytes * 1000000ULL / (kbPerS * 1024ULL)));
+}
+
+class SlowFlash : public FlashBackend {
+public:
+	SlowFlash(const char* path, int kbPerS) : m_file(path), m_rate(kbPerS) {}
+
+	bool begin(size_t size) override { return m_file.begin(size); }
+	bool write(const uint8_t* data, size_t len) override {
+		sleepFor(len, m_rate);
+		return m_file.write(data, len);
+	}
+	bool finish() override { return m_file.finish(); }
+	bool activate() override { return m_file.activate(); }
+	void abort() override { m_file.abort(); }
+
+private:
+	FileFlashBackend m_file;
+	int m_rate;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point t) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+}
+
+int main(int argc, char** argv) {
+	int sizeKb = 512, net = 400, flash = 300, c;
+	const char* path = "otabench.bin";
+	while ((c = getopt(argc, argv, "s:n:f:o:")) != -1) {
+		switch (c) {
+		case 's': sizeKb = atoi(optarg); break;
+		case 'n': net = atoi(optarg); break;
+		case 'f': flash = atoi(optarg); break;
+		case 'o': path = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-s image_kb] [-n net_kb_per_s] [-f flash_kb_per_s] [-o file]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	uint8_t digest[OTA_DIGEST_LEN];
+	{
+		static const uint8_t abc[] = {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea};
+		Sha256 sha;
+		sha.update((const uint8_t*)"abc", 3);
+		sha.finish(digest);
+		if (memcmp(digest, abc, sizeof(abc))) {
+			printf("SHA-256 self test failed\n");
+			return 1;
+		}
+	}
+
+	std::vector<uint8_t> image(sizeKb * 1024);
+	uint32_t x = 12345;
+	for (auto& b : image) {
+		x = x * 1103515245 + 12345;
+		b = x >> 16;
+	}
+	Sha256 sha;
+	sha.update(image.data(), image.size());
+	sha.finish(digest);
+
+	SlowFlash backend(path, flash);
+
+	//Serial: every chunk is hashed and written before the next one is received
+	auto t = std::chrono::steady_clock::now();
+	{
+		Sha256 h;
+		uint8_t out[OTA_DIGEST_LEN];
+		backend.begin(image.size());
+		for (size_t pos = 0; pos < image.size(); pos += MSS) {
+			size_t n = std::min(MSS, image.size() - pos);
+			sleepFor(n, net);
+			h.update(image.data() + pos, n);
+			backend.write(image.data() + pos, n);
+		}
+		backend.finish();
+		h.finish(out);
+		if (memcmp(out, digest, sizeof(out)))
+			printf("serial digest mismatch\n");
+	}
+	double serial = secondsSince(t);
+
+	t = std::chrono::steady_clock::now();
+	OtaUpdater ota(backend);
+	OtaStatus_t rc = ota.begin(image.size(), digest);
+	for (size_t pos = 0; rc == otaOk && pos < image.size(); pos += MSS) {
+		size_t n = std::min(MSS, image.size() - pos);
+		sleepFor(n, net);
+		rc = ota.feed(image.data() + pos, n);
+	}
+	if (rc == otaOk)
+		rc = ota.finish();
+	double pipelined = secondsSince(t);
+	if (rc != otaOk) {
+		printf("update failed: %s\n", otaStatusStr(rc));
+		return 1;
+	}
+
+	std::vector<uint8_t> check(image.size());
+	FILE* f = fopen(path, "rb");
+	size_t got = f ? fread(check.data(), 1, check.size(), f) : 0;
+	if (f)
+		fclose(f);
+	unlink(path);
+	if (got != image.size() || check != image) {
+		printf("written image differs\n");
+		return 1;
+	}
+
+	printf("image=%d KB net=%d KB/s flash=%d KB/s\n", sizeKb, net, flash);
+	printf("serial     %6.2f s  %7.1f KB/s\n", serial, sizeKb / serial);
+	printf("pipelined  %6.2f s  %7.1f KB/s  (%.2f s waiting for flash)\n", pipelined, sizeKb / pipelined,
+			ota.stallUs() / 1e6);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * routebench.cpp
+ *
+ * Dispatch time of the route trie (main/routetrie.hpp) against libesphttpd's
+ * top-down scan of builtInUrls, for growing route tables. The URL mix has
+ * exact API hits, wildcard hits and static files that only match the final
+ * "*" filesystem route. Both matchers are checked to pick the same route.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o routebench tools/routebench.cpp \
+ *            main/routetrie.cpp
+ * Usage: routebench [lookups]
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "routetrie.hpp"
+
+using namespace ecuspy;
+
+namespace {
+
+//Same test as the loop in httpdProcessRequest
+int linearMatch(const std::vector<const char*>& routes, const char* url) {
+	for (size_t i = 0; i < routes.size(); i++) {
+		const char* r = routes[i];
+		size_t l = strlen(r);
+		if (!strcmp(r, url) || (r[l - 1] == '*' && !strncmp(r, url, l - 1)))
+			return i;
+	}
+	return -1;
+}
+
+}
+
+int main(int argc, char** argv) {
+	int lookups = argc > 1 ? atoi(argv[1]) : 200000;
+
+	printf("%6s %6s %12s %12s\n", "routes", "nodes", "linear ns", "trie ns");
+	for (size_t count : {8, 16, 32, 64, 128, 256}) {
+		std::vector<std::string> text;
+		text.push_back("/");
+		for (size_t i = 0; i + 2 < count; i++) {
+			char buff[64];
+			if (i % 8 == 7)
+				snprintf(buff, sizeof(buff), "/static/g%zu/*", i);
+			else
+				snprintf(buff, sizeof(buff), "/api/group%zu/res%zu.cgi", i % 8, i);
+			text.push_back(buff);
+		}
+		text.push_back("*");
+		std::vector<const char*> routes;
+		for (auto& s : text)
+			routes.push_back(s.c_str());
+
+		RouteTrie trie;
+		for (size_t i = 0; i < routes.size(); i++)
+			trie.insert(routes[i], i);
+
+		std::vector<std::string> urls;
+		srand(1);
+		for (int i = 0; i < 1024; i++) {
+			int k = rand() % 10;
+			size_t r = 1 + rand() % (count - 2);
+			if (k < 5 && routes[r][strlen(routes[r]) - 1] != '*')
+				urls.push_back(routes[r]);
+			else if (k < 7)
+				urls.push_back("/static/g7/app.js");
+			else
+				urls.push_back("/css/style" + std::to_string(i % 16) + ".css");
+		}
+
+		uint16_t out[16];
+		for (auto& u : urls) {
+			trie.lookup(u.c_str(), out, 16);
+			if (out[0] != linearMatch(routes, u.c_str())) {
+				printf("mismatch for %s\n", u.c_str());
+				return 1;
+			}
+		}
+
+		volatile int sink = 0;
+		auto t = std::chrono::steady_clock::now();
+		for (int i = 0; i < lookups; i++)
+			sink += linearMatch(routes, urls[i % urls.size()].c_str());
+		double linear = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count();
+
+		t = std::chrono::steady_clock::now();
+		for (int i = 0; i < lookups; i++) {
+			trie.lookup(urls[i % urls.size()].c_str(), out, 16);
+			sink += out[0];
+		}
+		double tr = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count();
+
+		printf("%6zu %6zu %12.1f %12.1f\n", routes.size(), trie.nodes(), linear / lookups, tr / lookups);
+	}
+	return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * rpcbench.c
+ *
+ * Latency of config access over the websocket RPC channel (main/rpc.hpp)
+ * against the equivalent HTTP requests (/config.json, /config/set.cgi).
+ *
+ * Build: gcc -O2 -o rpcbench tools/rpcbench.c
+ * Usage: rpcbench [-h host] [-p port] [-n requests] [-w pipeline depth]
+ *                 [-i index] [-k id] [-v value]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define RPC_GET 0x01
+#define RPC_SET 0x02
+#define RPC_REPLY 0x80
+#define MAX_DEPTH 32
+
+static const char *host="192.168.4.1";
+static const char *port="80";
+static int requests=200;
+static int depth=1;
+static int index_=0;
+static const char *id="id1";
+static const char *value="abcd";
+static struct addrinfo *addr;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static int sendAll(int fd, const void *buf, int len) {
+	const char *p=buf;
+	while (len>0) {
+		int n=send(fd, p, len, 0);
+		if (n<=0) return -1;
+		p+=n;
+		len-=n;
+	}
+	return 0;
+}
+
+static int recvAll(int fd, void *buf, int len) {
+	char *p=buf;
+	while (len>0) {
+		int n=recv(fd, p, len, 0);
+		if (n<=0) return -1;
+		p+=n;
+		len-=n;
+	}
+	return 0;
+}
+
+static int openConn() {
+	int one=1;
+	int fd=socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+	if (fd<0) return -1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, addr->ai_addr, addr->ai_addrlen)<0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+	double x=*(const double*)a, y=*(const double*)b;
+	return (x>y)-(x<y);
+}
+
+static void report(const char *name, double *lat, int n, double elapsed) {
+	if (!n) {
+		printf("%-9s failed\n", name);
+		return;
+	}
+	qsort(lat, n, sizeof(double), cmpDouble);
+	printf("%-9s n=%d req/s=%.1f p50=%.2fms p99=%.2fms\n", name, n, n/elapsed,
+			lat[n/2]*1000, lat[(int)(n*0.99)]*1000);
+}
+
+static int wsOpen() {
+	char buf[1024];
+	int fd, l, got=0;
+	fd=openConn();
+	if (fd<0) return -1;
+	l=snprintf(buf, sizeof(buf), "GET /websocket/ws.cgi HTTP/1.1\r\nHost: %s\r\n"
+			"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+			"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n", host);
+	if (sendAll(fd, buf, l)<0) goto fail;
+	//Read the handshake reply byte by byte so no frame data gets swallowed
+	while (got<(int)sizeof(buf)-1 && recv(fd, buf+got, 1, 0)==1) {
+		got++;
+		if (got>=4 && !memcmp(buf+got-4, "\r\n\r\n", 4)) break;
+	}
+	buf[got]=0;
+	if (!strstr(buf, " 101 ")) goto fail;
+	return fd;
+fail:
+	close(fd);
+	return -1;
+}
+
+//Sends one masked binary websocket message
+static int wsSend(int fd, const unsigned char *data, int len) {
+	unsigned char hdr[8];
+	unsigned char msg[8+MAX_DEPTH*(7+64)];
+	int h=0, i;
+	hdr[h++]=0x82;
+	if (len<126) {
+		hdr[h++]=0x80|len;
+	} else {
+		hdr[h++]=0x80|126;
+		hdr[h++]=len>>8;
+		hdr[h++]=len&0xFF;
+	}
+	//All-zero mask keeps the payload as-is
+	memset(hdr+h, 0, 4);
+	h+=4;
+	memcpy(msg, hdr, h);
+	for (i=0; i<len; i++) msg[h+i]=data[i];
+	return sendAll(fd, msg, h+len);
+}
+
+//Reads one websocket message from the server, returns payload length
+static int wsRecv(int fd, unsigned char *buf, int max) {
+	unsigned char hdr[4];
+	int len;
+	if (recvAll(fd, hdr, 2)<0) return -1;
+	len=hdr[1]&0x7F;
+	if (len==126) {
+		if (recvAll(fd, hdr+2, 2)<0) return -1;
+		len=(hdr[2]<<8)|hdr[3];
+	}
+	if (len>max || recvAll(fd, buf, len)<0) return -1;
+	return len;
+}
+
+static int makeFrame(unsigned char *p, int op, int rid) {
+	int vlen=op==RPC_SET?strlen(value):0;
+	p[0]=op;
+	p[1]=rid&0xFF;
+	p[2]=rid>>8;
+	p[3]=(2+vlen)&0xFF;
+	p[4]=(2+vlen)>>8;
+	p[5]=index_&0xFF;
+	p[6]=index_>>8;
+	memcpy(p+7, value, vlen);
+	return 7+vlen;
+}
+
+//Pipelines `depth` requests per websocket message and matches replies by id
+static void benchWs(const char *name, int op) {
+	unsigned char out[MAX_DEPTH*(7+64)], in[4096];
+	double sent[MAX_DEPTH], *lat=malloc(sizeof(double)*requests), t0;
+	int fd, n=0, rid=0;
+
+	fd=wsOpen();
+	if (fd<0) {
+		report(name, lat, 0, 1);
+		free(lat);
+		return;
+	}
+	t0=now();
+	while (n<requests) {
+		int l=0, i, pending=depth;
+		if (pending>requests-n) pending=requests-n;
+		for (i=0; i<pending; i++) l+=makeFrame(out+l, op, rid+i);
+		for (i=0; i<pending; i++) sent[i]=now();
+		if (wsSend(fd, out, l)<0) break;
+		while (pending>0) {
+			int r=wsRecv(fd, in, sizeof(in)), pos=0;
+			if (r<0) goto done;
+			while (pos+5<=r) {
+				int frid=in[pos+1]|(in[pos+2]<<8), flen=in[pos+3]|(in[pos+4]<<8);
+				if ((in[pos]&RPC_REPLY) && frid>=rid && frid<rid+depth) {
+					lat[n++]=now()-sent[frid-rid];
+					pending--;
+				}
+				pos+=5+flen;
+			}
+		}
+		rid+=depth;
+	}
+done:
+	report(name, lat, n, now()-t0);
+	close(fd);
+	free(lat);
+}
+
+//One request per connection, the way the web UI does it
+static void benchHttp(const char *name, int set) {
+	char buf[4096];
+	double *lat=malloc(sizeof(double)*requests), t0;
+	int n=0, i;
+
+	t0=now();
+	for (i=0; i<requests; i++) {
+		double t=now();
+		int fd=openConn(), l, r, ok=0;
+		if (fd<0) break;
+		if (set) {
+			char body[256];
+			int bl=snprintf(body, sizeof(body), "%s=%s", id, value);
+			l=snprintf(buf, sizeof(buf), "POST /config/set.cgi HTTP/1.0\r\nHost: %s\r\n"
+					"Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n\r\n%s",
+					host, bl, body);
+		} else {
+			l=snprintf(buf, sizeof(buf), "GET /config.json HTTP/1.0\r\nHost: %s\r\n\r\n", host);
+		}
+		if (sendAll(fd, buf, l)==0) {
+			while ((r=recv(fd, buf, sizeof(buf), 0))>0) {
+				if (!ok && !strncmp(buf, "HTTP/", 5)) ok=strstr(buf, " 200 ")!=NULL;
+			}
+		}
+		close(fd);
+		if (!ok) break;
+		lat[n++]=now()-t;
+	}
+	report(name, lat, n, now()-t0);
+	free(lat);
+}
+
+int main(int argc, char **argv) {
+	struct addrinfo hints;
+	int opt;
+
+	while ((opt=getopt(argc, argv, "h:p:n:w:i:k:v:"))!=-1) {
+		switch (opt) {
+		case 'h': host=optarg; break;
+		case 'p': port=optarg; break;
+		case 'n': requests=atoi(optarg); break;
+		case 'w': depth=atoi(optarg); break;
+		case 'i': index_=atoi(optarg); break;
+		case 'k': id=optarg; break;
+		case 'v': value=optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-h host] [-p port] [-n requests] [-w depth] "
+					"[-i index] [-k id] [-v value]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (requests<1 || depth<1 || depth>MAX_DEPTH || strlen(value)>64) {
+		fprintf(stderr, "Bad arguments\n");
+		return 1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family=AF_UNSPEC;
+	hints.ai_socktype=SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addr)!=0) {
+		fprintf(stderr, "Can't resolve %s:%s\n", host, port);
+		return 1;
+	}
+
+	benchWs("ws-get", RPC_GET);
+	benchHttp("http-get", 0);
+	benchWs("ws-set", RPC_SET);
+	benchHttp("http-set", 1);
+	return 0;
+}
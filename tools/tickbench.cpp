@@ -0,0 +1,81 @@
+/*
+ * tickbench.cpp
+ *
+ * Host benchmark for the periodic timer (main/clock.hpp). Runs a loop with
+ * a varying amount of work per period, and a long spike now and then,
+ * paced two ways: sleeping a fixed delay after the work, which is what
+ * vTaskDelay(1000/portTICK_RATE_MS) does, and PeriodicTimer::wait(). For
+ * both it reports how far the last tick is off the ideal grid; for the
+ * timer also its jitter and overrun histograms.
+ *
+ * Build: g++ -std=c++11 -O2 -Imain -o tickbench tools/tickbench.cpp main/clock.cpp -lpthread
+ * Usage: tickbench [period_us] [ticks]
+ */
+
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <string>
+
+#include "clock.hpp"
+
+using namespace ecuspy;
+
+namespace {
+
+//Up to 40% of the period, every 50th tick 1.5 periods
+void work(uint32_t tick, uint32_t period) {
+	uint32_t us = tick % 50 == 49 ? period * 3 / 2 : rand() % (period * 2 / 5);
+	uint64_t end = clockUs() + us;
+	while (clockUs() < end)
+		;
+}
+
+void hist(const char* name, const uint32_t* h) {
+	printf("  %-8s", name);
+	for (size_t i = 0; i < CLOCK_HIST_BINS; i++)
+		printf(" %7u", (unsigned)h[i]);
+	printf("\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+	uint32_t period = argc > 1 ? atoi(argv[1]) : 10000;
+	uint32_t ticks = argc > 2 ? atoi(argv[2]) : 500;
+
+	srand(1);
+	uint64_t start = clockUs();
+	for (uint32_t i = 0; i < ticks; i++) {
+		work(i, period);
+		std::this_thread::sleep_for(std::chrono::microseconds(period));
+	}
+	int64_t drift = clockUs() - start - (uint64_t)ticks * period;
+	printf("delay after work: %u ticks of %u us, last one %lld us off the grid\n", (unsigned)ticks,
+			(unsigned)period, (long long)drift);
+
+	srand(1);
+	PeriodicTimer timer("bench", period);
+	uint32_t n = 0;
+	uint64_t last = 0;
+	start = clockUs();
+	for (uint32_t i = 0; n < ticks; i++) {
+		n += timer.wait();
+		last = clockUs();
+		work(i, period);
+	}
+	//The grid starts at the first wait(), its first deadline is a period later
+	drift = last - start - (uint64_t)n * period;
+	PeriodicStats st = timer.stats();
+	printf("PeriodicTimer:    %u ticks of %u us (%u missed), last one %lld us off the grid\n", (unsigned)st.ticks,
+			(unsigned)period, (unsigned)st.missed, (long long)drift);
+	printf("  us      ");
+	for (size_t i = 0; i < CLOCK_HIST_BINS - 1; i++)
+		printf(" %7s", ("<" + std::to_string(clockHistBounds[i])).c_str());
+	printf("    more\n");
+	hist("jitter", st.jitter);
+	hist("overrun", st.overrun);
+	printf("  max jitter %u us, %u overruns, max %u us\n", (unsigned)st.max_jitter_us, (unsigned)st.overruns,
+			(unsigned)st.max_overrun_us);
+	return 0;
+}
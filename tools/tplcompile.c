@@ -0,0 +1,143 @@
+/*
+ * tplcompile.c
+ *
+ * Build-time template precompiler: splits a libesphttpd style template
+ * (%token% placeholders, %% for a literal percent sign) into literal
+ * segments and token ids, in the .tplc layout described in main/cgi-tplc.h.
+ * Token ids come from main/tpltokens.def, an unknown token is an error.
+ *
+ * Build: cc -O2 -Imain -o tplcompile tools/tplcompile.c
+ * Usage: tplcompile in.tpl out.tplc
+ *        tplcompile -r dir      (every *.tpl below dir to *.tplc next to it)
+ */
+
+#define _XOPEN_SOURCE 500
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Must match main/cgi-tplc.h
+#define TPLC_MAGIC "TPLC"
+#define TPLC_VERSION 1
+#define TPLC_TOKEN 0x8000
+#define TPLC_MAX_LITERAL 0x7FFF
+#define MAX_TOKEN_LEN 64
+
+static const char *tokens[]={
+#define TPL_TOKEN(name, handler) #name,
+#include "tpltokens.def"
+#undef TPL_TOKEN
+};
+
+#define TOKENS (int)(sizeof(tokens)/sizeof(tokens[0]))
+
+static void putSeg(FILE *out, unsigned v) {
+	fputc(v&0xFF, out);
+	fputc(v>>8, out);
+}
+
+static void putLiteral(FILE *out, const char *data, size_t len) {
+	while (len) {
+		size_t n=len<TPLC_MAX_LITERAL ? len : TPLC_MAX_LITERAL;
+		putSeg(out, n);
+		fwrite(data, 1, n, out);
+		data+=n;
+		len-=n;
+	}
+}
+
+//Returns the number of token references, -1 on error
+static int compile(const char *in, const char *outName) {
+	FILE *f=fopen(in, "rb");
+	if (!f) {
+		perror(in);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *src=malloc(size+1);
+	if (!src || fread(src, 1, size, f)!=(size_t)size) {
+		fprintf(stderr, "%s: read failed\n", in);
+		fclose(f);
+		free(src);
+		return -1;
+	}
+	fclose(f);
+	src[size]=0;
+
+	FILE *out=fopen(outName, "wb");
+	if (!out) {
+		perror(outName);
+		free(src);
+		return -1;
+	}
+	fwrite(TPLC_MAGIC, 1, 4, out);
+	fputc(TPLC_VERSION, out);
+
+	int refs=0, rc=0;
+	const char *lit=src, *p=src;
+	while ((p=memchr(p, '%', src+size-p))) {
+		const char *end=memchr(p+1, '%', src+size-p-1);
+		if (!end) {
+			//A lone percent sign stays literal, like the runtime template engine does
+			break;
+		}
+		size_t len=end-p-1;
+		if (len==0) {
+			putLiteral(out, lit, p-lit+1);
+			lit=p=end+1;
+			continue;
+		}
+		int id;
+		for (id=0; id<TOKENS; id++) {
+			if (strlen(tokens[id])==len && !memcmp(tokens[id], p+1, len)) break;
+		}
+		if (id==TOKENS || len>MAX_TOKEN_LEN) {
+			fprintf(stderr, "%s: unknown token %%%.*s%%\n", in, (int)(len<MAX_TOKEN_LEN ? len : MAX_TOKEN_LEN), p+1);
+			rc=-1;
+			break;
+		}
+		putLiteral(out, lit, p-lit);
+		putSeg(out, TPLC_TOKEN|id);
+		refs++;
+		lit=p=end+1;
+	}
+	if (!rc) putLiteral(out, lit, src+size-lit);
+	if (fclose(out) || rc) {
+		remove(outName);
+		rc=-1;
+	}
+	free(src);
+	return rc ? -1 : refs;
+}
+
+static int failures=0;
+
+static int walk(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+	(void)st;
+	(void)ftw;
+	size_t l=strlen(path);
+	if (type!=FTW_F || l<4 || strcmp(path+l-4, ".tpl")) return 0;
+	char out[4096];
+	snprintf(out, sizeof(out), "%sc", path);
+	int refs=compile(path, out);
+	if (refs<0) failures++;
+	else printf("%s: %d token references\n", out, refs);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc==3 && !strcmp(argv[1], "-r")) {
+		if (nftw(argv[2], walk, 16, FTW_PHYS)) {
+			perror(argv[2]);
+			return 1;
+		}
+		return failures ? 1 : 0;
+	}
+	if (argc==3) return compile(argv[1], argv[2])<0 ? 1 : 0;
+	fprintf(stderr, "usage: %s in.tpl out.tplc | -r dir\n", argv[0]);
+	return 1;
+}